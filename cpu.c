@@ -45,7 +45,6 @@
 struct termios savetty;
 
 /* Interrupt thread synchronization */
-sem_t sem_int;
 
 /* mopc synchronization */
 sem_t sem_mopc;
@@ -56,6 +55,9 @@ sem_t sem_run;
 /* stopping cpu synchronization */
 sem_t sem_stop;
 
+/* idle cpu synchronization */
+sem_t sem_idle;
+
 /* Performance stuff */
 
 double instr_counter;
@@ -958,6 +960,18 @@ void ndfunc_ora(ushort operand){
 	gPC++;
 }
 
+/*
+ * Status flags from an NDFloat_* return value: -1 (result not exact) sets TG,
+ * exponent overflow (-2), underflow (-3) and divide by zero (1) set the
+ * error indicator Z.
+ */
+static inline void float_status(int res) {
+	if (res == -1)
+		setbit(_STS,_TG,1);
+	else if (res)
+		setbit(_STS,_Z,1);
+}
+
 /* FAD
  */
 void ndfunc_fad(ushort operand){
@@ -979,8 +993,7 @@ void ndfunc_fad(ushort operand){
 	gT = r[0];
 	gA = r[1];
 	gD = r[2];
-	if (res == -1)
-		setbit(_STS,_TG,1);
+	float_status(res);
 	if (trace) trace_post(3,"T",(int)gT,"A",(int)gA,"D",(int)gD);
 	gPC++;
 }
@@ -991,6 +1004,7 @@ void ndfunc_fsb(ushort operand){
 	bool UseAPT;
 	ushort eff_addr;
 	ushort a[3], b[3], r[3];
+	int res;
 
 	eff_addr = New_GetEffectiveAddr(operand,&UseAPT);
 	b[0] = gT;
@@ -1002,10 +1016,11 @@ void ndfunc_fsb(ushort operand){
 	b[2] = MemoryRead(eff_addr + 2,UseAPT);
 	if (trace) trace_pre(3,"T",(int)gT,"A",(int)gA,"D",(int)gD);
 	if (trace) trace_pre(3,"a+0",(int)b[0],"a+1",(int)b[1],"a+2",(int)b[2]);
-	NDFloat_Sub(a,b,r);
+	res=NDFloat_Sub(a,b,r);
 	gT = r[0];
 	gA = r[1];
 	gD = r[2];
+	float_status(res);
 	if (trace) trace_post(3,"T",(int)gT,"A",(int)gA,"D",(int)gD);
 	gPC++;
 }
@@ -1016,6 +1031,7 @@ void ndfunc_fmu(ushort operand){
 	bool UseAPT;
 	ushort eff_addr;
 	ushort a[3], b[3], r[3];
+	int res;
 
 	eff_addr = New_GetEffectiveAddr(operand,&UseAPT);
 	a[0] = gT;
@@ -1026,10 +1042,11 @@ void ndfunc_fmu(ushort operand){
 	b[2] = MemoryRead(eff_addr + 2,UseAPT);
 	if (trace) trace_pre(3,"T",(int)gT,"A",(int)gA,"D",(int)gD);
 	if (trace) trace_pre(3,"a+0",(int)b[0],"a+1",(int)b[1],"a+2",(int)b[2]);
-	NDFloat_Mul(a,b,r);
+	res=NDFloat_Mul(a,b,r);
 	gT = r[0];
 	gA = r[1];
 	gD = r[2];
+	float_status(res);
 	if (trace) trace_post(3,"T",(int)gT,"A",(int)gA,"D",(int)gD);
 	gPC++;
 }
@@ -1040,6 +1057,7 @@ void ndfunc_fdv(ushort operand){
 	bool UseAPT;
 	ushort eff_addr;
 	ushort a[3], b[3], r[3];
+	int res;
 
 	eff_addr = New_GetEffectiveAddr(operand,&UseAPT);
 	a[0] = gT;
@@ -1050,10 +1068,11 @@ void ndfunc_fdv(ushort operand){
 	b[2] = MemoryRead(eff_addr + 2,UseAPT);
 	if (trace) trace_pre(3,"T",(int)gT,"A",(int)gA,"D",(int)gD);
 	if (trace) trace_pre(3,"a+0",(int)b[0],"a+1",(int)b[1],"a+2",(int)b[2]);
-	NDFloat_Div(a,b,r);
+	res=NDFloat_Div(a,b,r);
 	gT = r[0];
 	gA = r[1];
 	gD = r[2];
+	float_status(res);
 	if (trace) trace_post(3,"T",(int)gT,"A",(int)gA,"D",(int)gD);
 	gPC++;
 }
@@ -1069,6 +1088,10 @@ void ndfunc_jmp(ushort operand){
 	gPC = eff_addr;
 	if (DISASM)
 		disasm_userel(old_gPC,gPC);
+	/* Idle loops: JMP * and, on level 0 where WAIT is a no-op, WAIT followed by JMP *-1 */
+	if (IDLE && ((eff_addr == old_gPC) ||
+	    ((eff_addr == (ushort)(old_gPC-1)) && (CurrLEVEL == 0) && ((MemoryFetch(eff_addr,false) & 0177400) == 0151000))))
+		CpuIdle();
 
 }
 
@@ -1203,6 +1226,7 @@ void ndfunc_irw(ushort operand){
 
 	temp = ((operand & 0x0078) >> 3);
 	dr = (operand & 0x0007);
+	LazyFlagSync();
 	if (( temp == gPIL ) && (dr == 2)) /* P on current level, this becomes NOOP */
 		;
 	else
@@ -1216,6 +1240,7 @@ void ndfunc_irw(ushort operand){
 /* IRR
  */
 void ndfunc_irr(ushort operand){
+	LazyFlagSync();
 	gA = gReg->reg[((operand & 0x0078) >> 3)][(operand & 0x0007)];
 	if ((operand & 0x0007) == 0)	/* clear top 8 bits as STS reg read */
 		gA &= 0x00FF;
@@ -1585,6 +1610,164 @@ void ndfunc_skp(ushort operand){
 		gPC++;
 }
 
+/*
+ * Byte string helpers for MOVB, MOVBF and BFILL.
+ * Strings are worked a page at a time straight in host memory when the TLB
+ * already holds the page with the right permit. Otherwise one byte is done
+ * through MemoryRead/MemoryWrite, which fills the TLB or raises the fault
+ * exactly as a single access would, and the next byte tries the TLB again.
+ * Byte 0 of a word is the MSB (left byte).
+ */
+static inline ushort *mem_tlb_ptr(ushort addr, bool UseAPT, unsigned char perm) {
+	struct TLBEntry *tlb = &gTLB[CurrLEVEL][((STS_PTM) && UseAPT) ? 1 : 0][addr>>10];
+	return (tlb->perm & perm) ? &tlb->page[addr & (((ushort)1<<10) - 1)] : NULL;
+}
+
+static inline ushort mem_getbyte(ushort *p, unsigned int b) {
+	return (b & 1) ? p[b>>1] & 0xff : p[b>>1] >> 8;
+}
+
+static inline void mem_putbyte(ushort *p, unsigned int b, ushort val) {
+	p[b>>1] = (b & 1) ? (p[b>>1] & 0xff00) | val : (p[b>>1] & 0x00ff) | (val<<8);
+}
+
+/*
+ * Copy n bytes, low to high or high to low. memmove is only used when
+ * source and destination have the same byte alignment and it gives the
+ * same result as the byte by byte copy in that direction.
+ */
+static void mem_copy_bytes(ushort *dst, unsigned int db, ushort *src, unsigned int sb, int n, bool backward) {
+	long dpos = (long)(dst - VolatileMemory->n_Array)*2 + db;
+	long spos = (long)(src - VolatileMemory->n_Array)*2 + sb;
+	int k, words;
+	if (((db ^ sb) & 1) == 0 &&
+	   ((dpos+n <= spos) || (spos+n <= dpos) || (backward ? dpos >= spos : dpos <= spos))) {
+		if (!backward && (db & 1)) { /* odd leading byte */
+			mem_putbyte(dst,db,mem_getbyte(src,sb));
+			db++; sb++; n--;
+		}
+		if (backward && ((db+n) & 1)) { /* odd trailing byte */
+			mem_putbyte(dst,db+n-1,mem_getbyte(src,sb+n-1));
+			n--;
+		}
+		words = (n - (db & 1)) >> 1;
+		if (backward) {
+			if ((db & 1) && n) {
+				memmove(&dst[(db+1)>>1],&src[(sb+1)>>1],words*2);
+				mem_putbyte(dst,db,mem_getbyte(src,sb));
+			} else {
+				memmove(&dst[db>>1],&src[sb>>1],words*2);
+			}
+		} else {
+			memmove(&dst[db>>1],&src[sb>>1],words*2);
+			if (n & 1) /* odd trailing byte */
+				mem_putbyte(dst,db+n-1,mem_getbyte(src,sb+n-1));
+		}
+		return;
+	}
+	if (backward) {
+		for (k=n-1;k>=0;k--)
+			mem_putbyte(dst,db+k,mem_getbyte(src,sb+k));
+	} else {
+		for (k=0;k<n;k++)
+			mem_putbyte(dst,db+k,mem_getbyte(src,sb+k));
+	}
+}
+
+/*
+ * Byte i of the string starting at word addr, in the right byte first if lr,
+ * through the normal memory routines.
+ */
+static ushort byte_read(ushort addr, ushort lr, int i, bool apt) {
+	ushort w = MemoryRead(addr + ((i+lr)>>1),apt);	/* Word adress of byte to read */
+	return ((i+lr)&1) ? w & 0xff : (w >> 8) & 0xff; /* right, LSB : left, MSB */
+}
+
+static void byte_write(ushort addr, ushort lr, int i, bool apt, ushort val) {
+	MemoryWrite(val & 0xff,addr + ((i+lr)>>1),apt,((i+lr)&1));	/* Word adress of byte to write */
+}
+
+/*
+ * Move byte i of the source string to byte i of the destination string.
+ */
+static void movb_byte(ushort source, ushort s_lr, bool s_apt, ushort dest, ushort d_lr, bool d_apt, int i) {
+	byte_write(dest,d_lr,i,d_apt,byte_read(source,s_lr,i,s_apt));
+}
+
+/*
+ * Move len bytes. backward copies the highest byte first.
+ */
+static void movb_run(ushort source, ushort s_lr, bool s_apt, ushort dest, ushort d_lr, bool d_apt, int len, bool backward) {
+	int i, n, sn, dn;
+	unsigned int sb, db;
+	ushort saddr, daddr, *sp, *dp;
+	i = (backward) ? len-1 : 0;	/* next byte to move */
+	while (len > 0) {
+		sb = i+s_lr;
+		db = i+d_lr;
+		saddr = source + (sb>>1);
+		daddr = dest + (db>>1);
+		sp = mem_tlb_ptr(saddr,s_apt,TLB_READ);
+		dp = mem_tlb_ptr(daddr,d_apt,TLB_WRITE);
+		if (!sp || !dp) {
+			movb_byte(source,s_lr,s_apt,dest,d_lr,d_apt,i);
+			i += (backward) ? -1 : 1;
+			len--;
+			continue;
+		}
+		if (backward) { /* bytes from here down to the start of the page */
+			sn = (saddr & 01777)*2 + (sb & 1) + 1;
+			dn = (daddr & 01777)*2 + (db & 1) + 1;
+			n = (len < sn) ? len : sn;
+			n = (n < dn) ? n : dn;
+			i -= n-1;	/* lowest byte of this chunk */
+			sp -= (ushort)(saddr - (ushort)(source + ((i+s_lr)>>1)));
+			dp -= (ushort)(daddr - (ushort)(dest + ((i+d_lr)>>1)));
+			mem_copy_bytes(dp,(i+d_lr) & 1,sp,(i+s_lr) & 1,n,true);
+			i--;
+		} else { /* bytes from here up to the end of the page */
+			sn = (1024 - (saddr & 01777))*2 - (sb & 1);
+			dn = (1024 - (daddr & 01777))*2 - (db & 1);
+			n = (len < sn) ? len : sn;
+			n = (n < dn) ? n : dn;
+			mem_copy_bytes(dp,db & 1,sp,sb & 1,n,false);
+			i += n;
+		}
+		len -= n;
+	}
+}
+
+/*
+ * Fill len bytes from dest/d_lr with thebyte.
+ */
+static void bfill_run(ushort dest, ushort d_lr, bool d_apt, ushort thebyte, int len) {
+	int i, n, dn, words;
+	unsigned int db;
+	ushort daddr, *dp;
+	for (i=0;i<len;i+=n) {
+		db = i+d_lr;
+		daddr = dest + (db>>1);
+		dp = mem_tlb_ptr(daddr,d_apt,TLB_WRITE);
+		if (!dp) {
+			MemoryWrite(thebyte,daddr,d_apt,(db & 1));
+			n = 1;
+			continue;
+		}
+		dn = (1024 - (daddr & 01777))*2 - (db & 1);
+		n = (len-i < dn) ? len-i : dn;
+		dn = n;
+		if (db & 1) { /* odd leading byte */
+			mem_putbyte(dp,1,thebyte);
+			dp++;
+			dn--;
+		}
+		for (words = dn>>1; words > 0; words--)
+			*dp++ = (thebyte<<8) | thebyte;
+		if (dn & 1) /* odd trailing byte */
+			mem_putbyte(dp,0,thebyte);
+	}
+}
+
 /* BFILL
  * IN X and T registers point to address and number of bytes.
  * A contains the byte to write
@@ -1595,25 +1778,18 @@ void ndfunc_skp(ushort operand){
  * Which means eventually we have to do this function reentrant. Yuck!! /Roger
  */
 void ndfunc_bfill(ushort operand){
-	ushort d1,d2,len,addr,i;
+	ushort d1,len;
 	ushort right = (gT & ((ushort)1<<15)) ? 1 : 0; /* Start with right byte? (LSB) */
 	bool is_apt = (gT & ((ushort)1<<14)) ? true : false; /* Use APT or not? */
 	ushort thebyte = gA & 0xff;
 	len=gT & 0x0fff; /* Number of bytes to do */
-	addr=gX; /* just in case we do 0 bytes */
 	d1=gX;
-	d2=gT;
 	if (trace) trace_pre(2,"X",(int)gX,"T",(int)gT);
 	if (trace) trace_step(1,"S:(%06o)-",(int)gX);
-//	if (debug) fprintf(debugfile,"BFILL(ante): gX:%06o gT:%06o byte:%03o len:%d\n",gX,gT,thebyte,len);
-	for (i=0;i<len;i++) {
-		addr = d1 + ((i+right)>>1); /* Word adress of byte to write */
-		MemoryWrite(thebyte,addr,is_apt,((i+right)&1));
-	}
+	bfill_run(d1,right,is_apt,thebyte,len);
 	gT &= 0x7000; /* Null number of bytes, as per manual, also null bit 15 */
-	gT |= ((i+right) & 1)<<15; /* set bit 15 to point to next free byte */
-	gX = d1 + ((i+right)>>1);
-//	if (debug) fprintf(debugfile,"BFILL(post): gX:%06o gT:%06o addr:%d len:%d right:%d\n",gX,gT,addr,len,right);
+	gT |= ((len+right) & 1)<<15; /* set bit 15 to point to next free byte */
+	gX = d1 + ((len+right)>>1);
 
 	gPC++; /* This function has a SKIP return on no error, which is always? */
 	if (trace) trace_step(1,"-E:(%06o)",(int)gX); /* -E:(%06o)<=%s */
@@ -1621,6 +1797,36 @@ void ndfunc_bfill(ushort operand){
 	gPC++;
 }
 
+/*
+ * TSET - Test and set (CX option). A := (X), then (X) := 177777, as one instruction.
+ */
+void ndfunc_tset(ushort operand){
+	ushort w;
+	gMemFault = false;
+	w = MemoryRead(gX,false);
+	if (!gMemFault)
+		MemoryWrite(0177777,gX,false,2);
+	if (gMemFault)	/* leave A and P, so it is restarted */
+		return;
+	gA = w;
+	if (trace) trace_step(1,"A<=(X), (X)<=177777",0);
+	gPC++;
+}
+
+/*
+ * RDUS - Read without using the cache (CX option). A := (X). We have no cache, so this is a plain read.
+ */
+void ndfunc_rdus(ushort operand){
+	ushort w;
+	gMemFault = false;
+	w = MemoryRead(gX,false);
+	if (gMemFault)
+		return;
+	gA = w;
+	if (trace) trace_step(1,"A<=(X)",0);
+	gPC++;
+}
+
 /* INIT
  * INIT instruction:
  * IN: nothing. uses PC.
@@ -1791,17 +1997,12 @@ void ndfunc_mix3(ushort operand){
 }
 
 
+/*
+ * do_op - Execute one instruction
+ * instr_funcs is indexed by the complete instruction word, so all decoding
+ * is left to the handler. Nothing else should be done here per instruction.
+ */
 void do_op(ushort operand){
-	ushort instr;
-	char numstr[BUFSTRSIZE];
-	char offset;
-	offset = (char)(operand & 0x00ff);
-
-	/* put offset into a string variable in octal with +/- sign for easy reading */
-	((int)offset <0) ? (void)snprintf(numstr,BUFSTRSIZE,"-%o",-(int)offset) : (void)snprintf(numstr,BUFSTRSIZE,"%o",offset);
-
-	instr=extract_opcode(operand);
-
 	instr_funcs[operand](operand);	/* call using a function pointer from the array
 					this way we are as flexible as possible as we
 					implement io calls. */
@@ -1837,6 +2038,7 @@ void regop(ushort operand) { /* SWAP RAND REXO RORA RADD RCLR EXIT RDCR RING RSU
 	sr = ((operand & 0x0038) >> 3);
 	dr = (operand & 0x0007);
 	source = (sr==0) ? 0 : gReg->reg[CurrLEVEL][sr] & 0xFFFF; /* handles special case when sr=STS reg */
+	if ((sr==0) || (dr==0)) LazyFlagSync(); /* may write STS */
 
 	gPC++;	/* Count up first, as if P is used, it's the value of the next instruction. */
 	switch (RAD) {
@@ -1947,6 +2149,40 @@ ushort GetEffectiveAddr(ushort instr) {
 	return(res);
 }
 
+/*
+ * Effective address forms. Bits 0-10 of a memory reference instruction
+ * (the mode bits and the displacement) are decoded once per instruction
+ * word by Setup_EffectiveAddr, New_GetEffectiveAddr only calls the form.
+ */
+typedef ushort (*ea_func)(short disp);
+
+struct EADecode {
+	ea_func func;		/* computes the address for this mode */
+	short disp;		/* sign extended displacement */
+	bool use_apt;		/* use the alternative page table */
+};
+
+static struct EADecode ea_decode[04000];
+
+static ushort ea_p(short disp) { return gPC + disp; }				/* (P) + disp */
+static ushort ea_b(short disp) { return gB + disp; }				/* (B) + disp */
+static ushort ea_ind_p(short disp) { return MemoryRead(gPC + disp,false); }	/* ((P) + disp) */
+static ushort ea_ind_b(short disp) { return MemoryRead(gB + disp,true); }	/* ((B) + disp) */
+static ushort ea_x(short disp) { return gX + disp; }				/* (X) + disp */
+static ushort ea_bx(short disp) { return gB + gX + disp; }			/* (B) + disp + (X) */
+static ushort ea_ind_px(short disp) { return gX + MemoryRead(gPC + disp,false); }	/* ((P) + disp) + (X) */
+static ushort ea_ind_bx(short disp) { return gX + MemoryRead(gB + disp,true); }	/* ((B) + disp) + (X) */
+
+void Setup_EffectiveAddr() {
+	static const ea_func forms[8] = { ea_p, ea_b, ea_ind_p, ea_ind_b, ea_x, ea_bx, ea_ind_px, ea_ind_bx };
+	int i;
+	for (i=0;i<04000;i++) {
+		ea_decode[i].func = forms[i >> 8];
+		ea_decode[i].disp = (signed char)(i & 0xFF);
+		ea_decode[i].use_apt = ((i >> 8) != 0);	/* only (P) + disp uses the normal page table */
+	}
+}
+
 /* Calculates the effective address to use.
  * Uses MemoryRead to do this so we get the Page Table handling
  * done correctly. Also sets the bool use_apt points to, to tell caller what PT
@@ -1954,47 +2190,9 @@ ushort GetEffectiveAddr(ushort instr) {
  * See Manual ND.06.014, Page 34
  */
 ushort New_GetEffectiveAddr(ushort instr, bool *use_apt) {
-	char disp = instr & 0xFF;
-	ushort eff_addr;
-	switch((instr>>8) & 0x07) {
-	case 0:	/* (P) + disp */
-		eff_addr = gPC + disp;
-		*use_apt = false;
-		break;
-	case 1:	/* (B) + disp */
-		eff_addr = gB + disp;
-		*use_apt = true;
-		break;
-	case 2:	/* ((P) + disp) */
-		eff_addr = gPC + disp;
-		eff_addr = MemoryRead(eff_addr,false);
-		*use_apt = true;
-		break;
-	case 3:	/* ((B) + disp) */
-		eff_addr =  gB + disp;
-		eff_addr = MemoryRead(eff_addr,true);
-		*use_apt = true;
-		break;
-	case 4:	/* (X) + disp */
-		eff_addr= gX + disp;
-		*use_apt = true;
-		break;
-	case 5:	/* (B) + disp + (X) */
-		eff_addr = gB + gX + disp;
-		*use_apt = true;
-		break;
-	case 6:	/* ((P) + disp) + (X) */
-		eff_addr =  gPC + disp;
-		eff_addr = gX + MemoryRead(eff_addr,false);
-		*use_apt = true;
-		break;
-	case 7:	/* ((B) + disp) + (X) */
-		eff_addr =  gB + disp;
-		eff_addr = gX + MemoryRead(eff_addr,true);
-		*use_apt = true;
-		break;
-	}
-	return eff_addr;
+	const struct EADecode *ea = &ea_decode[instr & 03777];
+	*use_apt = ea->use_apt;
+	return ea->func(ea->disp);
 }
 
 /*
@@ -2006,9 +2204,9 @@ ushort New_GetEffectiveAddr(ushort instr, bool *use_apt) {
  * NOTE:: STS need to be checked.
  */
 void DoMCL(ushort instr) {
-	int s;
 	switch(instr & 0x0F) {
 	case 01:
+		LazyFlagSync();
 		gReg->reg[CurrLEVEL][0] &= ~(gA & 0x00FF);
 //		ushort reg_a = gA;
 //		SystemSTS &= ~(reg_a & 0xF000);
@@ -2017,28 +2215,16 @@ void DoMCL(ushort instr) {
 	case 06:
 		/* This affects interrupt, so do locking and checking. */
 		if (trace) trace_pre(2,"PID",gPID,"A",gA);
-
-		gPID &= ~gA;
-		if (sem_post(&sem_int) == -1) { /* release interrupt lock */
-			if (debug) fprintf(debugfile,"ERROR!!! sem_post failure DOMCL\n");
-			CurrentCPURunMode = SHUTDOWN;
-		}
-
-		checkPK();
+		__atomic_and_fetch(&gPID,(ushort)~gA,__ATOMIC_ACQ_REL);
+		SetIntPending();
 		if (trace) trace_step(1,"PID {AND}{NOT} A",0);
 		if (trace) trace_post(1,"PID",gPID);
 		break;
 	case 07:
 		/* This affects interrupt, so do locking and checking. */
 		if (trace) trace_pre(2,"PIE",gPIE,"A",gA);
-		while ((s = sem_wait(&sem_int)) == -1 && errno == EINTR) /* wait for interrupt lock to be free */
-			continue; /* Restart if interrupted by handler */
-		gPIE &= ~gA;
-		if (sem_post(&sem_int) == -1) { /* release interrupt lock */
-			if (debug) fprintf(debugfile,"ERROR!!! sem_post failure DOMCL\n");
-			CurrentCPURunMode = SHUTDOWN;
-		}
-		checkPK();
+		__atomic_and_fetch(&gPIE,(ushort)~gA,__ATOMIC_ACQ_REL);
+		SetIntPending();
 		if (trace) trace_step(1,"PIE {AND}{NOT} A",0);
 		if (trace) trace_post(1,"PIE",gPIE);
 		break;
@@ -2058,9 +2244,9 @@ void DoMCL(ushort instr) {
  * NOTE:: STS need to be checked.
  */
 void DoMST(ushort instr) {
-	int s;
 	switch(instr & 0x0F) {
 	case 01:
+		LazyFlagSync();
 		gReg->reg[CurrLEVEL][0] |= (gA & 0x00ff);
 //		ushort reg_a = gA;
 //		SystemSTS |= reg_a & 0xF000;
@@ -2069,28 +2255,16 @@ void DoMST(ushort instr) {
 	case 06:
 		/* This affects interrupt, so do locking and checking. */
 		if (trace) trace_pre(2,"PID",gPID,"A",gA);
-		while ((s = sem_wait(&sem_int)) == -1 && errno == EINTR) /* wait for interrupt lock to be free */
-			continue; /* Restart if interrupted by handler */
-		gPID |= gA;
-		if (sem_post(&sem_int) == -1) { /* release interrupt lock */
-			if (debug) fprintf(debugfile,"ERROR!!! sem_post failure DOMCL\n");
-			CurrentCPURunMode = SHUTDOWN;
-		}
-		checkPK();
+		__atomic_or_fetch(&gPID,gA,__ATOMIC_ACQ_REL);
+		SetIntPending();
 		if (trace) trace_step(1,"PID {AND}{NOT} A",0);
 		if (trace) trace_post(1,"PID",gPID);
 		break;
 	case 07:
 		/* This affects interrupt, so do locking and checking. */
 		if (trace) trace_pre(2,"PIE",gPIE,"A",gA);
-		while ((s = sem_wait(&sem_int)) == -1 && errno == EINTR) /* wait for interrupt lock to be free */
-			continue; /* Restart if interrupted by handler */
-		gPIE |= gA;
-		if (sem_post(&sem_int) == -1) { /* release interrupt lock */
-			if (debug) fprintf(debugfile,"ERROR!!! sem_post failure DOMCL\n");
-			CurrentCPURunMode = SHUTDOWN;
-		}
-		checkPK();
+		__atomic_or_fetch(&gPIE,gA,__ATOMIC_ACQ_REL);
+		SetIntPending();
 		if (trace) trace_step(1,"PIE {AND}{NOT} A",0);
 		if (trace) trace_post(1,"PIE",gPIE);
 		break;
@@ -2139,10 +2313,10 @@ void DoCLEPT() {
 			UseAPT = (0 == (0400 & (0x03<<8))) ? true : false;
 			eff_addr = New_GetEffectiveAddr(0400,&UseAPT);
 			MemoryWrite(0,eff_addr,UseAPT,2);
-			/* LDXTX 00*/
-			fulladdress = (((unsigned int)gT) <<16) | gX;
-			gX = PhysMemRead(fulladdress);
 		}
+		/* LDXTX 00, done also when A=0 (JAZ *3 lands on it) */
+		fulladdress = (((unsigned int)gT) <<16) | gX;
+		gX = PhysMemRead(fulladdress);
 	}
 }
 
@@ -2152,9 +2326,7 @@ void DoCLEPT() {
  *  A = <IR>;
  */
 void DoTRA(ushort instr) {
-	int s;
 	ushort temp,level;
-	ushort i;
 	switch(instr & 0x0F) {
 	case 00: /* TRA PANS */
 		gA = gPANS;
@@ -2162,6 +2334,7 @@ void DoTRA(ushort instr) {
 		if (debug) fprintf(debugfile,"TRA PANS: A <= %06o\n",gA);
 		break;
 	case 01: /* TRA STS */
+		LazyFlagSync();
 		gA= gReg->reg[gPIL][_STS]; /* If everything is done correctly elsewhere this should work fine */
 		if (trace) trace_step(1,"A<=STS",0);
 		break;
@@ -2172,14 +2345,8 @@ void DoTRA(ushort instr) {
 		break;
 	case 03: /* TRA PGS */
 		/* TODO:: Check that this also is supposed to clear the PGS as it "unlocks" it */
-		while ((s = sem_wait(&sem_int)) == -1 && errno == EINTR) /* wait for interrupt lock to be free */
-			continue; /* Restart if interrupted by handler */
-		gA = gPGS;
+		gA = gPGS; /* Only written by the cpu thread, no locking needed */
 		gPGS=0;
-		if (sem_post(&sem_int) == -1) { /* release interrupt lock */
-			if (debug) fprintf(debugfile,"ERROR!!! sem_post failure DOMCL\n");
-			CurrentCPURunMode = SHUTDOWN;
-		}
 		if (trace) trace_step(1,"A<=PGS",0);
 		break;
 	case 04: /* TRA PVL */
@@ -2191,20 +2358,10 @@ void DoTRA(ushort instr) {
 	case 05: /* TRA IIC */
 		/* Manuals says(2.2.4.3) that this should be a number equal to the highest bit set in (IID & IIE) - Roger */
 		/* Only bit 1-10 is used, so we only return a value between 1 and 10  or else  zero */
-		while ((s = sem_wait(&sem_int)) == -1 && errno == EINTR) /* wait for interrupt lock to be free */
-			continue; /* Restart if interrupted by handler */
-		gIIC = 0;
-		temp=gIID & gIIE;
-		for (i=1;i<16;i++) {
-			gIIC = ((1<<i) & temp) ? i : gIIC;
-		}
+		temp = __atomic_exchange_n(&gIID,0,__ATOMIC_ACQ_REL) & __atomic_load_n(&gIIE,__ATOMIC_ACQUIRE) & 0xfffe;
+		gIIC = (temp) ? 31 - __builtin_clz(temp) : 0;
 		gA = gIIC;
-		gIID = 0;
 		gReg->mylock_IIC = false;
-		if (sem_post(&sem_int) == -1) { /* release interrupt lock */
-			if (debug) fprintf(debugfile,"ERROR!!! sem_post failure DOMCL\n");
-			CurrentCPURunMode = SHUTDOWN;
-		}
 		if (trace) trace_step(1,"A<=IIC",0);
 		break;
 	case 06:
@@ -2282,7 +2439,6 @@ void DoEXR(ushort instr) {
  * Also no privilege checks are done as of yet.
  */
 void DoWAIT(ushort instr) {
-	int s;
 	ushort temp;
 	if(!STS_IONI) { /* Interrupt is off, HALT cpu */
 		gPC++;
@@ -2294,14 +2450,8 @@ void DoWAIT(ushort instr) {
 	} else {
 		gPC++;
 		temp= ~(1<<CurrLEVEL); /* Now we have a 0 in the position we want */
-		while ((s = sem_wait(&sem_int)) == -1 && errno == EINTR) /* wait for interrupt lock to be free */
-			continue; /* Restart if interrupted by handler */
-		gPID &= temp; /* Give up this level */
-		if (sem_post(&sem_int) == -1) { /* release interrupt lock */
-			if (debug) fprintf(debugfile,"ERROR!!! sem_post failure DOMCL\n");
-			CurrentCPURunMode = SHUTDOWN;
-		}
-		checkPK();
+		__atomic_and_fetch(&gPID,temp,__ATOMIC_ACQ_REL); /* Give up this level */
+		SetIntPending();
 	}
 }
 
@@ -2313,7 +2463,6 @@ void DoWAIT(ushort instr) {
  * NOTE: STS and PCR NOT fixed yet!!!
  */
 void DoTRR(ushort instr) {
-	int s;
 	ushort temp,level;
 	if (trace) trace_pre(1,"A",(int)gA);
 	switch(instr & 0x0F) {
@@ -2330,6 +2479,7 @@ void DoTRR(ushort instr) {
 		break;
 	case 01:
 		/* ND-06.029.1 ND-110 Instruction Set, lists only lower 8 bits as changeable... */
+		LazyFlagSync();
 		gReg->reg[CurrLEVEL][_STS] = (gReg->reg[CurrLEVEL][_STS] & 0xff00) | (gA & 0x00ff); /* Only change LSB  */
 		if (trace) trace_step(1,"STS(LSB)<=A",0);
 		break;
@@ -2342,41 +2492,24 @@ void DoTRR(ushort instr) {
 		temp = gA;
 		level = (temp >> 3) & 0x0f;
 		gReg->reg_PCR[level]= temp & 0x0783; /* Mask out so we only get PT, APT, RING as per Manual*/
+		TLB_FlushLevel(level);
 		if (trace) trace_step(1,"PCR(%d)<=A",level);
 		break;
 	case 05:
-		while ((s = sem_wait(&sem_int)) == -1 && errno == EINTR) /* wait for interrupt lock to be free */
-			continue; /* Restart if interrupted by handler */
-		gIIE = gA;
-		if (sem_post(&sem_int) == -1) { /* release interrupt lock */
-			if (debug) fprintf(debugfile,"ERROR!!! sem_post failure DOMCL\n");
-			CurrentCPURunMode = SHUTDOWN;
-		}
-		checkPK();
+		__atomic_store_n(&gIIE,gA,__ATOMIC_RELEASE);
+		SetIntPending();
 		if (trace) trace_step(1,"IIE<=A",0);
 		break;
 	case 06:
 		/* This affects interrupt, so do locking and checking. */
-		while ((s = sem_wait(&sem_int)) == -1 && errno == EINTR) /* wait for interrupt lock to be free */
-			continue; /* Restart if interrupted by handler */
-		gPID = gA;
-		if (sem_post(&sem_int) == -1) { /* release interrupt lock */
-			if (debug) fprintf(debugfile,"ERROR!!! sem_post failure DOMCL\n");
-			CurrentCPURunMode = SHUTDOWN;
-		}
-		checkPK();
+		__atomic_store_n(&gPID,gA,__ATOMIC_RELEASE);
+		SetIntPending();
 		if (trace) trace_step(1,"PID<=A",0);
 		break;
 	case 07:
 		/* This affects interrupt, so do locking and checking. */
-		while ((s = sem_wait(&sem_int)) == -1 && errno == EINTR) /* wait for interrupt lock to be free */
-			continue; /* Restart if interrupted by handler */
-		gPIE = gA;
-		if (sem_post(&sem_int) == -1) { /* release interrupt lock */
-			if (debug) fprintf(debugfile,"ERROR!!! sem_post failure DOMCL\n");
-			CurrentCPURunMode = SHUTDOWN;
-		}
-		checkPK();
+		__atomic_store_n(&gPIE,gA,__ATOMIC_RELEASE);
+		SetIntPending();
 		if (trace) trace_step(1,"PIE<=A",0);
 		break;
 	case 010:
@@ -2410,6 +2543,7 @@ void DoSRB(ushort operand) {
 
 	lvl = ((operand & 0x0078) >> 3);
 	addr=gX;
+	LazyFlagSync();
 
 	if (trace) trace_pre(1,"X",(int)gX);
 
@@ -2467,6 +2601,7 @@ void DoLRB(ushort operand) {
 
 	lvl = ((operand & 0x0078) >> 3);
 	addr=gX;
+	LazyFlagSync();
 
 	if (trace) trace_pre(1,"X",(int)gX);
 
@@ -2705,22 +2840,18 @@ ulong ShiftDoubleReg(ulong reg, ushort instr) {
  * Handles IDENT PLxx instructions
  */
 void DoIDENT(char priolevel) {
-	int s;
 	ushort id = 0;
-	struct IdentChain *curr = gIdentChain;
-	while ((s = sem_wait(&sem_int)) == -1 && errno == EINTR) /* wait for interrupt lock to be free */
-		continue; /* Restart if interrupted by handler */
-	while(curr){
-		if (curr->level == priolevel) {
-			id = curr->identcode; /* IDENT code found. Store it */
-			RemIdentChain(curr); /* Remove item since we now have identified it */
-			break;
-		} else
-			curr=curr->next;
-	}
-	if (sem_post(&sem_int) == -1) { /* release interrupt lock */
-		if (debug) fprintf(debugfile,"ERROR!!! sem_post failure DoIDENT\n");
-		CurrentCPURunMode = SHUTDOWN;
+	int w;
+	unsigned long long v, bit;
+	unsigned long long *map = gIdent[IDENT_LEVEL(priolevel)];
+	/* Lowest pending ident code wins. Only the cpu thread clears bits, so a bit seen set stays set */
+	for (w=0; w<IDENT_WORDS && !id; w++) {
+		v = __atomic_load_n(&map[w],__ATOMIC_ACQUIRE);
+		if (v) {
+			bit = v & -v;
+			__atomic_and_fetch(&map[w],~bit,__ATOMIC_ACQ_REL); /* Remove it since we now have identified it */
+			id = (w<<6) | __builtin_ctzll(v);
+		}
 	}
 	if (id) {
 		gA=id; /* Set A reg to ident code */
@@ -2734,18 +2865,15 @@ void DoIDENT(char priolevel) {
 }
 
 /*
- * MOVB instruction. TODO:: Fix edge case and document params here...
+ * MOVB instruction.
+ * IN: A/D source word address and descriptor, X/T destination word address and descriptor.
+ * Descriptor bit 15 = start with right byte, bit 14 = use APT, bits 11-0 = number of bytes.
+ * Copies high to low if the destination is above the source, so overlapping fields move intact.
  */
 void DoMOVB(ushort instr) {
 	ushort source,dest,lens,lend,len,s_lr,d_lr,s_apt,d_apt;
 	int dir; /* direction, 0=low to high, 1 = high to low */
-	int i;
-	ushort thebyte;
-	ushort addr_d, addr_s;
 
-	addr_d = 0;
-	addr_s = 0;
-	dir = 0;
 	source=gA;
 	dest=gX;
 	lens=gD & 0x0fff;
@@ -2756,42 +2884,19 @@ void DoMOVB(ushort instr) {
 	d_apt = ((gT >> 14) & 1);
 	len = (((int) lens-lend)<0) ? lens : lend; /* get smallest length as number to copy */
 	/* Check overlap if any and direction to copy */
-	if (((int)source-dest)<0) {
-		dir = 1;
-	} else if (((int)source-dest)==0) { /* :TODO: check bytes to determine direction, or if no need to copy exist */
-
-	} else {
-		dir = 0;
-	}
+	dir = (((int)source-dest)<0) ? 1 : 0;
 //	if (debug) fprintf(debugfile,"MOVB(ante): gA:%06o gD:%06o gX:%06o gT:%06o len:%d\n",gA,gD,gX,gT,len);
 	/* COPY */
-	if (dir) { /* high to low */
-		for (i=len-1;i>=0;i--) {
-			addr_s = source + ((i+s_lr)>>1); /* Word adress of byte to read */
-			thebyte = MemoryRead(addr_s,s_apt);
-			thebyte = ((i+d_lr)&1) ? thebyte : (thebyte >> 8) &0xff; /* right, LSB : left, MSB */
-			addr_d = dest + ((i+d_lr)>>1); /* Word adress of byte to write */
-			MemoryWrite(thebyte,addr_d,d_apt,((i+d_lr)&1));
-		}
-		i=0;
-	} else { /* low to high */
-		for (i=0;i<len;i++) {
-			addr_s = source + ((i+s_lr)>>1); /* Word adress of byte to read */
-			thebyte = MemoryRead(addr_s,s_apt);
-			thebyte = ((i+d_lr)&1) ? thebyte : (thebyte >> 8) &0xff; /* right, LSB : left, MSB */
-			addr_d = dest + ((i+d_lr)>>1); /* Word adress of byte to write */
-			MemoryWrite(thebyte,addr_d,d_apt,((i+d_lr)&1));
-		}
-	}
+	movb_run(source,s_lr,s_apt,dest,d_lr,d_apt,len,dir);
 
 	gD &= 0x7000; /* Null number of bytes, as per manual, also null bit 15 */
 	gT &= 0x7000; /* Null number of bytes, also null bit 15 */
-	gD |= ((i+d_lr) & 1)<<15; /* set bit 15 to point to next free byte */
-	gT |= ((i+d_lr) & 1)<<15; /* set bit 15 to point to next free byte */
+	gD |= ((len+s_lr) & 1)<<15; /* set bit 15 to point to next free byte */
+	gT |= ((len+d_lr) & 1)<<15; /* set bit 15 to point to next free byte */
 	gT |= len & 0x0fff; /* number of bytes done to lowest 12 bits*/
 
-	gA = addr_s + ((len+s_lr)>>1);
-	gX = addr_d + ((len+d_lr)>>1);
+	gA = source + ((len+s_lr)>>1);
+	gX = dest + ((len+d_lr)>>1);
 //	if (debug) fprintf(debugfile,"MOVB(post): gA:%06o gD:%06o gX:%06o gT:%06o len:%d\n",gA,gD,gX,gT,len);
 
 	gPC++; /* This function has a SKIP return on no error, which is always? */
@@ -2800,19 +2905,16 @@ void DoMOVB(ushort instr) {
 }
 
 /*
- * MOVBF instruction. TODO:: ALL
+ * MOVBF instruction.
+ * Like MOVB but always copies low to high, and counts both descriptors down.
+ * No skip return if the fields overlap.
  */
 void DoMOVBF(ushort instr) {
 	ushort source,dest,lens,lend,len,s_lr,d_lr,s_apt,d_apt;
-	int i;
-	ushort thebyte;
-	ushort addr_d, addr_s;
 	source=gA;
 	dest=gX;
 	bool overlap;
 
-	addr_d = 0;
-	addr_s = 0;
 	lens=gD & 0x0fff;
 	lend=gT & 0x0fff;
 	s_lr = ((gD >> 15) & 1);
@@ -2833,23 +2935,17 @@ void DoMOVBF(ushort instr) {
 	if (debug) fprintf(debugfile,"MOVBF(dec): gA:%06d gD:%06d gX:%06d gT:%06d gPC:%06d len:%06d\n",gA,gD,gX,gT,gPC,len);
 	if (debug) fprintf(debugfile,"MOVBF(pre): overlap=%d\n",overlap);
 
-	for (i=0;i<len;i++) {
-		addr_s = source + ((i+s_lr)>>1); /* Word adress of byte to read */
-		thebyte = MemoryRead(addr_s,s_apt);
-		thebyte = ((i+d_lr)&1) ? thebyte : (thebyte >> 8) &0xff; /* right, LSB : left, MSB */
-		addr_d = dest + ((i+d_lr)>>1); /* Word adress of byte to write */
-		MemoryWrite(thebyte,addr_d,d_apt,((i+d_lr)&1));
-		lens--;
-		lend--;
-	}
+	movb_run(source,s_lr,s_apt,dest,d_lr,d_apt,len,false);
+	lens -= len;
+	lend -= len;
 
 	gA = source + ((len+s_lr)>>1);
 	gX = dest + ((len+d_lr)>>1);
 
-	gD &= 0xefff; /* Null bit 12 */
-	gT &= 0xcfff; /* Null bit 12 & 13 */
-	gD |= ((i+d_lr) & 1)<<15; /* set bit 15 to point to next free byte */
-	gT |= ((i+d_lr) & 1)<<15; /* set bit 15 to point to next free byte */
+	gD &= 0x6fff; /* Null bit 12 & 15 */
+	gT &= 0x4fff; /* Null bit 12, 13 & 15 */
+	gD |= ((len+s_lr) & 1)<<15; /* set bit 15 to point to next free byte */
+	gT |= ((len+d_lr) & 1)<<15; /* set bit 15 to point to next free byte */
 
 	gD &= 0xf000; /* clean lowest bits before or */
 	gT &= 0xf000; /* clean lowest bits before or */
@@ -2860,7 +2956,7 @@ void DoMOVBF(ushort instr) {
 	if (!overlap) gPC++;
 	gPC++; /* This function has a SKIP return on no error */
 	if (debug) fprintf(debugfile,"MOVBF(post): gA:%06o gD:%06o gX:%06o gT:%06o gPC:%06o len:%d\n",gA,gD,gX,gT,gPC,len);
-	if (debug) fprintf(debugfile,"MOVBF(post): addr_s=%d addr_d=%d s_lr=%d d_lr=%d len:%d\n",addr_s,addr_d,s_lr,d_lr,len);
+	if (debug) fprintf(debugfile,"MOVBF(post): s_lr=%d d_lr=%d len:%d\n",s_lr,d_lr,len);
 	if (debug) fprintf(debugfile,"*********************************************************************\n");
 	return;
 }
@@ -2991,12 +3087,14 @@ void setreg(int r, int val) { /* FIXME - kolla upp flaggor */
 
 ushort getbit(ushort regnum, ushort stsbit) {
 	ushort result;
+	if (regnum == _STS) LazyFlagSync();
 	result=((gReg->reg[CurrLEVEL][regnum] >> stsbit) & 1);
 	return result;
 }
 
 void clrbit(ushort regnum, ushort stsbit) {
 	ushort thebit;
+	if (regnum == _STS) LazyFlagSync();
 	thebit=(1 << stsbit) ^ 0xFFFF;
 	gReg->reg[CurrLEVEL][regnum] = (thebit & gReg->reg[CurrLEVEL][regnum]);
 }
@@ -3020,20 +3118,40 @@ void setbit_STS_MSB(ushort stsbit, char val) {
 		for(i=0;i<=15;i++)
 			gReg->reg[i][_STS] = gReg->reg[i][_STS] & thebit;
 	}
-
+	HotStateSync();
+	if ((stsbit == _SEXI) || (stsbit == _PONI)) /* Cached translations depend on these */
+		TLB_Flush();
 
 }
 
 void setPIL(char val) {
 	int i;
+	LazyFlagSync(); /* flags belong to the level we leave */
 	for(i=0;i<=15;i++){
 		gReg->reg[i][_STS] &= 0xf0ff; /* clear PIL bits first */
 		gReg->reg[i][_STS] = gReg->reg[i][_STS] | ((val & 0x0f)<<8);
 	}
+	HotStateSync();
+}
+
+/*
+ * HotStateSync:
+ * Refresh gHot from the STS MSB bits. Must be called after anything that
+ * changes PIL or the STS MSB flags, or replaces the register file.
+ */
+void HotStateSync(void) {
+	ushort sts = gReg->reg[0][_STS];
+	gHot.level = (sts & 0x0f00) >>8;
+	gHot.bank = gReg->reg[gHot.level];
+	gHot.ioni = (sts >> _IONI) & 1;
+	gHot.poni = (sts >> _PONI) & 1;
+	gHot.sexi = (sts >> _SEXI) & 1;
+	MemModeSync();
 }
 
 void setbit(ushort regnum, ushort stsbit, char val) {
 	ushort thebit = 0;
+	if (regnum == _STS) LazyFlagSync();
 	if (val) {
 		thebit=(1 << stsbit);
 		gReg->reg[CurrLEVEL][regnum] = (thebit | gReg->reg[CurrLEVEL][regnum]);
@@ -3043,25 +3161,42 @@ void setbit(ushort regnum, ushort stsbit, char val) {
 	}
 }
 
+/*
+ * do_add:
+ * C and Q are left in gLazy, see LazyFlagSync. Only the sticky O is set here.
+ */
 ushort do_add(ushort a, ushort b, ushort k) {
 	int tmp;
-	bool is_diff;
 	tmp = ((int)a) + ((int)b) + ((int)k);
-	/* C (carry) */
-	if (tmp & 0xffff0000)
-		setbit(_STS,_C,1);
-	else
-		setbit(_STS,_C,0);
-	/* O(static overflow), Q (dynamic overflow) */
-	is_diff = (((1<<15)&a)^((1<<15)&b)); /* is bit 15 of the two operands different? */
-	if(!(is_diff) && (((1<<15)&a)^((1<<15)&tmp))) { /* if equal and result is different... */
-		setbit(_STS,_O,1);
-		setbit(_STS,_Q,1);
-	} else
-		setbit(_STS,_Q,0);
+	/* O(static overflow), set if bit 15 of the operands are equal and the result is different */
+	if(!((a^b) & (1<<15)) && ((a^tmp) & (1<<15)))
+		gHot.bank[_STS] |= (1<<_O);
+	gLazy.a = a;
+	gLazy.b = b;
+	gLazy.res = tmp;
+	gLazy.pending = true;
 	return (ushort)tmp;
 }
 
+/*
+ * LazyFlagSync:
+ * Write C (carry) and Q (dynamic overflow) of the last do_add to STS
+ * of the current level. Must be done before anything reads or writes
+ * STS LSB, and before the level changes.
+ */
+void LazyFlagSync(void) {
+	ushort sts;
+	if (!gLazy.pending)
+		return;
+	gLazy.pending = false;
+	sts = gHot.bank[_STS] & ~((1<<_C) | (1<<_Q));
+	if (gLazy.res & 0xffff0000)
+		sts |= (1<<_C);
+	if(!((gLazy.a^gLazy.b) & (1<<15)) && ((gLazy.a^gLazy.res) & (1<<15)))
+		sts |= (1<<_Q);
+	gHot.bank[_STS] = sts;
+}
+
 void AdjustSTS(ushort reg_a, ushort operand, int result) {
 	/* C (carry) */
 	if(result > 0xFFFF)
@@ -3120,6 +3255,13 @@ void mopc_cmd(char *cmdstr, char cmdc){
 	}
 	switch (cmdc) {
 	case '.':
+		if (strcmp(cmdstr,"SNAP") == 0) { /* SNAP. saves a snapshot */
+			if (CurrentCPURunMode == STOP)
+				SnapshotSave(SNAPSHOT_FILE);
+			else
+				SnapshotRequest();
+			break;
+		}
 		/* Set breakpoint */
 		if (!(has_val));	/*TODO: Check whats needed here */
 		if ((val>=0) && (val < 65536)){ /* valid range for 16 bit addr */
@@ -3215,49 +3357,126 @@ void mopc_thread(){
 
 /*
  * Change PK if conditions for it's setting are right.
- *
+ * Only called from the cpu thread, when gIntPending has been set.
+ * PK is the highest level (1-15) set in both PID and PIE.
  */
 void checkPK() {
-	int s;
-	ushort lvl;
-	ushort i;
-	gPK=0;
-	while ((s = sem_wait(&sem_int)) == -1 && errno == EINTR) /* wait for interrupt lock to be free */
-		continue; /* Restart if interrupted by handler */
-	i = gPIE & gPID;
-//	if (debug) fprintf(debugfile,"PT DEB CheckPK: gPIE=%06o gPID=%06o i=%06o gPK=%d gPIL=%d\n",gPIE,gPID,i,gPK,gPIL);
-	if (i) { /* Do we have a pending interupt condition */
-		for (lvl=1;lvl<16;lvl++) {
-			gPK = (i & 1<<lvl) ? lvl : gPK; /* Will retain highest bit set as level*/
-//			if (debug) fprintf(debugfile,"PT DEB CheckPK: lvl=%d gPK=%d gPIL=%d\n",lvl,gPK,gPIL);
-		}
-	}
-	if (sem_post(&sem_int) == -1) { /* release interrupt lock */
-		if (debug) fprintf(debugfile,"ERROR!!! sem_post failure DOMCL\n");
-		CurrentCPURunMode = SHUTDOWN;
-	}
+	unsigned int i;
+	i = __atomic_load_n(&gPIE,__ATOMIC_ACQUIRE) & __atomic_load_n(&gPID,__ATOMIC_ACQUIRE) & 0xfffe;
+	gPK = (i) ? 31 - __builtin_clz(i) : 0;
 }
 
 /*
  * Main interruptsetting routine.
  * IN: interrupt level and possible subbitfield
  * for those levels that has that. (LVL 14).
+ * Safe to call from any thread, PID/IID are updated atomically
+ * and the cpu thread picks up the change through gIntPending.
  */
 void interrupt(ushort lvl, ushort sub){
-	int s;
-	while ((s = sem_wait(&sem_int)) == -1 && errno == EINTR) /* wait for interrupt lock to be free */
-		continue; /* Restart if interrupted by handler */
 	if (lvl == 14) {
-		gIID |= sub;
-		if (gIID & gIIE) gPID|= (1<<14);
+		if (__atomic_or_fetch(&gIID,sub,__ATOMIC_ACQ_REL) & __atomic_load_n(&gIIE,__ATOMIC_ACQUIRE))
+			__atomic_or_fetch(&gPID,1<<14,__ATOMIC_ACQ_REL);
 	} else {
-		gPID |= (1 << lvl) ;
+		__atomic_or_fetch(&gPID,1<<lvl,__ATOMIC_ACQ_REL);
 	}
-	if (sem_post(&sem_int) == -1) { /* release interrupt lock */
-		if (debug) fprintf(debugfile,"ERROR!!! sem_post failure DOMCL\n");
-		CurrentCPURunMode = SHUTDOWN;
+	SetIntPending();
+	CpuWake();
+}
+
+/*
+ * CpuIdle - Block the cpu thread until something can happen.
+ * Called from guest idle loops, where only an interrupt (or a stop from
+ * outside) can get the cpu anywhere. gIdle is set before looking at PID,
+ * and interrupt()/CpuWake() clear it before posting sem_idle, so a wakeup
+ * between the check and the wait is not lost and sem_idle is posted at
+ * most once per wait. The wait is capped at a second, in case some
+ * thread stops the cpu without calling CpuWake().
+ */
+void CpuIdle(void) {
+	struct timespec ts;
+	int s;
+	if (CurrentCPURunMode != RUN)
+		return;
+	if (RTC_VIRTUAL && STS_IONI && (CurrLEVEL < 13) && (gPIE & (1<<13)) && sys_rtc->irq_en) {
+		EventSkip(); /* nothing to wait for but the clock, so skip ahead to the next tick */
+		return;
+	}
+	__atomic_store_n(&gIdle,true,__ATOMIC_SEQ_CST);
+	if ((CurrentCPURunMode != RUN) ||
+	    (STS_IONI && (((__atomic_load_n(&gPIE,__ATOMIC_SEQ_CST) & __atomic_load_n(&gPID,__ATOMIC_SEQ_CST) & 0xfffe) >> (CurrLEVEL+1)) != 0))) {
+		if (__atomic_exchange_n(&gIdle,false,__ATOMIC_SEQ_CST))
+			return; /* nobody has posted, just go on */
+		while ((s = sem_wait(&sem_idle)) == -1 && errno == EINTR) /* eat the post of the wakeup that beat us */
+			continue;
+		return;
 	}
-	checkPK();
+	clock_gettime(CLOCK_REALTIME,&ts);
+	ts.tv_sec++;
+	while ((s = sem_timedwait(&sem_idle,&ts)) == -1 && errno == EINTR) /* wait for an interrupt */
+		continue;
+	if ((s == -1) && !__atomic_exchange_n(&gIdle,false,__ATOMIC_SEQ_CST)) {
+		while ((s = sem_wait(&sem_idle)) == -1 && errno == EINTR) /* timed out while being woken */
+			continue;
+	}
+}
+
+/*
+ * CpuWake - Release the cpu thread if it is blocked in CpuIdle.
+ * Safe to call from any thread and from signal handlers.
+ */
+void CpuWake(void) {
+	if (__atomic_exchange_n(&gIdle,false,__ATOMIC_SEQ_CST))
+		sem_post(&sem_idle);
+}
+
+/*
+ * TLB_Flush - Forget all cached translations.
+ * Used when SEXI or PONI changes, or the cpu is cleared.
+ */
+void TLB_Flush(void) {
+	memset(gTLB,0,sizeof(gTLB));
+}
+
+/*
+ * TLB_FlushLevel - Forget cached translations for one runlevel.
+ * Used when the PCR of that level is changed.
+ */
+void TLB_FlushLevel(ushort level) {
+	memset(gTLB[level & 0x0f],0,sizeof(gTLB[0]));
+}
+
+/*
+ * TLB_FlushPage - Forget cached translations of a virtual page.
+ * We do not know which levels use the page table the entry belongs to,
+ * so the page is dropped for all levels and both PT and APT.
+ */
+void TLB_FlushPage(unsigned char vpn) {
+	int i;
+	for(i=0;i<=15;i++) {
+		gTLB[i][0][vpn & 0x3f].perm = 0;
+		gTLB[i][1][vpn & 0x3f].perm = 0;
+	}
+}
+
+/*
+ * TLB_Fill - Remember a translation that has passed all checks.
+ * Ring 3 and POF can see the page tables in the top of the address space,
+ * so that page is never cached for them. Nothing is cached while memory
+ * accesses are traced, so every access reaches the accessors that log it.
+ */
+void TLB_Fill(unsigned char vpn, bool apt, ushort ppn, unsigned char perm) {
+	struct TLBEntry *tlb = &gTLB[CurrLEVEL][apt ? 1 : 0][vpn];
+	if (perm & TLB_WRITE) /* writes through the TLB entry go unseen, so the page is dirty from now */
+		MemDirty(ppn);
+	if((((gReg->reg_PCR[CurrLEVEL] & 0x03) == 3) || !(STS_PONI)) && (vpn == 63))
+		return;
+	if (trace & 0x08)
+		return;
+	if(tlb->page != VolatileMemory->n_Pages[ppn])
+		tlb->perm = 0;
+	tlb->page = VolatileMemory->n_Pages[ppn];
+	tlb->perm |= perm;
 }
 
 /*
@@ -3310,6 +3529,7 @@ void PT_Write(ushort value, ushort addr, ushort byte_select){
 	}
 //	if (debug) fprintf(debugfile,"PT_Write: ==> temp=%08x\n",temp);
 	gPT->pt_arr[ptadd]=temp;
+	TLB_FlushPage(ptadd & 0x3f);
 	if (trace & 0x08) fprintf(tracefile,
 		"#m (i,t,a) #v# (\"%d\",\"Write PageTables\",\"%08o\");\n",
 		(int)instr_counter,addr);
@@ -3346,9 +3566,13 @@ void PhysMemWrite(ushort value, ulong addr){
 		PT_Write(value,(ushort)addr,2); /* 2 = word write */
 		return;
 	}
-	addr &= (ND_Memsize); /* Mask it to the memory size we have to prevent coredumps :) */
-	p_phy_addr = &VolatileMemory.n_Array[addr];
+	if (addr >= ND_Memsize) { /* No memory there */
+		interrupt(14,1<<9); /* Memory out of range */
+		return;
+	}
+	p_phy_addr = &VolatileMemory->n_Array[addr];
 	*p_phy_addr = value;
+	MemDirty(addr>>10);
 }
 
 /*
@@ -3360,99 +3584,18 @@ ushort PhysMemRead(ulong addr){
 		res = PT_Read((ushort)addr);
 		return(res); /* PT data */
 	}
-	addr &= (ND_Memsize); /* Mask it to the memory size we have to prevent coredumps :) */
-	return VolatileMemory.n_Array[addr];
+	if (addr >= ND_Memsize) { /* No memory there */
+		interrupt(14,1<<9); /* Memory out of range */
+		return 0;
+	}
+	return VolatileMemory->n_Array[addr];
 }
 
 /*
- * Write a word to memory.
- * Here we implement all Memory Management System functions.
+ * Store a word or byte through a host pointer to guest memory.
+ * :NOTE: ND memory is big endian but NDemulator is little endian!
  */
-void MemoryWrite(ushort value, ushort addr, bool UseAPT, unsigned char byte_select) {
-	ushort pcr = gReg->reg_PCR[CurrLEVEL];
-	unsigned char ring_num = pcr & 0x03;
-	unsigned char vpn = addr>>10;
-	ushort ppn;
-	unsigned char pt_num;
-	ulong PTe;
-	ushort* p_phy_addr;
-//	bool error = false;
-
-	/* just debug the virtual address for now. later on we got to get the real address I think */
-	/* this is for now so we can get output of all memory accesses in a program and debug instructions at full speed */
-//	if (trace) AddMemTrace((unsigned int)addr,'W');
-
-	/* First we check if Shadow Memory is accessible. */
-	if(IsShadowMemAccess((ulong)addr)) { /* Write to PageTables!!! */
-		PT_Write(value,addr,byte_select);
-		return;
-	}
-	if (STS_PONI) {
-		if((STS_PTM) && UseAPT)
-			pt_num = (pcr>>7) & 0x03;	/* APT */
-		else
-			pt_num = (pcr>>9) & 0x03;	/* PT */
-
-		PTe = gPT->pt[pt_num][vpn];
-
-		/* Check if not WPM(Write Permit bit is not set) */
-		if (!(PTe & (1<<31))) {
-//			debug=1; /* PT DEBUGGING: remove once finished */
-			if (!(PTe & (0x07<<29))) {
-				interrupt(14,1<<3);  /* Page Fault */
-				gPGS= pt_num<<6 | (vpn & 0x3f) | 1<<14; /* Page Fault */
-//				if (debug) fprintf(debugfile,
-//					"WriteMemory: Page Fault, instr#=%d PTe=%08x pt_num=%d vpn=%d\n",
-//					(int)instr_counter,PTe,pt_num,vpn);
-			} else {
-				interrupt(14,1<<2); /* Memory Protection Violation */
-				gPGS= pt_num<<6 | (vpn & 0x3f) | 1<<14; /* Permit Violation */
-//				if (debug) fprintf(debugfile,
-//					"WriteMemory: Memory Protection Violation, instr#=%d PTe=%08x pt_num=%d vpn=%d\n",
-//						(int)instr_counter,PTe,pt_num,vpn);
-			}
-			if (trace & 0x08) fprintf(tracefile,
-				"#m (i,t,a) #v# (\"%d\",\"Write Fail(WPM)\",\"%08o\");\n",
-				(int)instr_counter,addr);
-			return;
-//			error=true;
-		}
-
-		/* Check if ring number is too low */
-		if(((PTe>>24) & 0x03) > ring_num) {
-//			debug=1; /* PT DEBUGGING: remove once finished */
-//			if (debug) fprintf(debugfile,"WriteMemory: Ring Violation, PTe=%08x pt_num=%d vpn=%d\n",PTe,pt_num,vpn);
-			gPGS = ((ushort)pt_num<<6) | vpn; /* Ring Violation */
-			interrupt(14,1<<2); /* Ring Protection Violation */
-			if (trace & 0x08) fprintf(tracefile,
-				"#m (i,t,a) #v# (\"%d\",\"Write Fail(Ring)\",\"%08o\");\n",
-				(int)instr_counter,addr);
-			return;
-//			error=true;
-		}
-//		if(error) return;
-
-		/* Mark that the page was written and used */
-		gPT->pt[pt_num][vpn] |= ((ulong)0x03<<27); /* Set WIP and PGU */
-
-		/* Get physical page number */
-		ppn = (STS_SEXI) ? PTe & 0x3fff : PTe & 0x01ff;
-
-//		if (debug) fprintf(debugfile,"WriteMemory: OK, PTe=%08x pt_num=%d vpn=%d ppn=%04x\n",PTe,pt_num,vpn,ppn);
-//		if (debug) fprintf(debugfile,"WriteMemory: OK, gPT->pt[pt_num][vpn]=%08x\n",gPT->pt[pt_num][vpn]);
-
-		p_phy_addr = &VolatileMemory.n_Pages[ppn][addr & (((ushort)1<<10) - 1)];
-		if (trace& 0x08) fprintf(tracefile,
-			"#m (i,t,a) #v# (\"%d\",\"Write (PT)\",\"%08o\");\n",
-			(int)instr_counter,addr);
-	} else {
-		p_phy_addr = &VolatileMemory.n_Array[addr];	/* Only 16 address bits in POF mode */
-		if (trace & 0x08) fprintf(tracefile,
-			"#m (i,t,a) #v# (\"%d\",\"Write ()\",\"%08o\");\n",
-			(int)instr_counter,addr);
-	}
-
-	// :NOTE: ND memory is big endian but NDemulator is little endian!
+static inline void mem_store(ushort *p_phy_addr, ushort value, unsigned char byte_select) {
 	switch(byte_select) {
 	case 0:		/* Even, which means MSB byte, or bits 15-8 */
 		*p_phy_addr = (*p_phy_addr & 0xFF) | (value<<8);
@@ -3467,174 +3610,212 @@ void MemoryWrite(ushort value, ushort addr, bool UseAPT, unsigned char byte_sele
 }
 
 /*
- * Read a word from memory.
- * Here we implement all Memory Management System functions.
+ * mem_translate - Page table walk for a PON access that missed the TLB.
+ * perm is one of TLB_READ, TLB_WRITE or TLB_FETCH and selects which permit bit,
+ * PGS layout and used/written marking applies. sexi is a constant in each caller.
+ * Returns NULL after raising the interrupt if the access is not allowed.
  */
-ushort MemoryRead(ushort addr, bool UseAPT) {
+static inline __attribute__((always_inline)) ushort *mem_translate(ushort addr, bool UseAPT, const bool sexi, const unsigned char perm) {
 	ushort pcr = gReg->reg_PCR[CurrLEVEL];
 	unsigned char ring_num = pcr & 0x03;
-	ulong PTe;
-	ushort res;
 	unsigned char vpn = addr>>10;
+	bool apt = (STS_PTM) && UseAPT;
+	unsigned char pt_num = (apt) ? (pcr>>7) & 0x03 : (pcr>>9) & 0x03;	/* APT : PT */
+	ulong PTe = gPT->pt[pt_num][vpn];
+	ulong permit = (perm == TLB_WRITE) ? (ulong)1<<31 : (perm == TLB_READ) ? (ulong)1<<30 : (ulong)1<<29;
+	const char *what = (perm == TLB_WRITE) ? "Write" : (perm == TLB_READ) ? "Read" : "Fetch";
 	ushort ppn;
-	unsigned char pt_num;
-//	bool error = false;
-
-
-	/* just debug the virtual address for now. later on we got to get the real address I think */
-	/* this is for now so we can get output of all memory accesses in a program and debug instructions at full speed */
-//	if (trace) AddMemTrace((unsigned int)addr,'R');
-
-	/* First we check if Shadow Memory is accessible. */
-	if(IsShadowMemAccess((ulong)addr)) { /* Read from PageTables!!! */
-		res = PT_Read(addr);
-		return(res); /* PT data */
-	}
 
-	if(STS_PONI) {
-		if((STS_PTM) && UseAPT)
-			pt_num = (pcr>>7) & 0x03;	// APT
+	/* Check permit bit (WPM, RPM or FPM) */
+	if (!(PTe & permit)) {
+		gPGS = ((perm == TLB_FETCH) ? ((ushort)3<<14) : ((ushort)1<<14)) | ((ushort)pt_num<<6) | vpn;
+		if (!(PTe & ((ulong)0x07<<29)))
+			interrupt(14,1<<3); /* Page Fault */
 		else
-			pt_num = (pcr>>9) & 0x03;	// PT
-
-		PTe = gPT->pt[pt_num][vpn];
+			interrupt(14,1<<2); /* Memory Protection Violation */
+		if (trace & 0x08) fprintf(tracefile,
+			"#m (i,t,a) #v# (\"%d\",\"%s Fail(%cPM)\",\"%08o\");\n",
+			(int)instr_counter,what,what[0],addr);
+		gMemFault = true;
+		return NULL;
+	}
 
-		/* Check if not RPM(Read Permit bit is not set) */
-		if (!(PTe & ((ulong)1<<30))) {
-//			debug=1; /* PT DEBUGGING: remove once finished */
-			gPGS = ((ushort)1<<14) | ((ushort)pt_num<<6) | vpn;
-			if (!(PTe & ((ulong)0x07<<29))) {
-//				if (debug) fprintf(debugfile,"ReadMemory: Page Fault, PTe=%08x\n",PTe);
-				interrupt(14,1<<3); /* Page Fault */
-			} else {
-//				if (debug) fprintf(debugfile,"ReadMemory: Memory protection Violation, PTe=%08x\n",PTe);
-				interrupt(14,1<<2); /* Memory Protection Violation */
-			}
-			if (trace & 0x08) fprintf(tracefile,
-				"#m (i,t,a) #v# (\"%d\",\"Read Fail(RPM)\",\"%08o\");\n",
-				(int)instr_counter,addr);
-			return(0); /* TODO:: We should rethink MemoryRead to handle errors more gracefully. */
-//			error=true;
-		}
+	/* Check if ring number is too low */
+	if(((PTe>>24) & 0x03) > ring_num) {
+		gPGS = ((perm == TLB_FETCH) ? ((ushort)1<<15) : 0) | ((ushort)pt_num<<6) | vpn;
+		interrupt(14,1<<2); /* Ring Protection Violation */
+		if (trace & 0x08) fprintf(tracefile,
+			"#m (i,t,a) #v# (\"%d\",\"%s Fail(Ring)\",\"%08o\");\n",
+			(int)instr_counter,what,addr);
+		gMemFault = true;
+		return NULL;
+	}
 
-		/* Check if ring number is too low */
-		if(((PTe>>24) & 0x03) > ring_num) {
-// 			debug=1; /* PT DEBUGGING: remove once finished */
-			gPGS = ((ushort)pt_num<<6) | vpn;
-			interrupt(14,1<<2); /* Ring Protection Violation */
-//			if (debug) fprintf(debugfile,"ReadMemory: Ring Violation, PTe=%08x\n",PTe);
-			if (trace & 0x08) fprintf(tracefile,
-				"#m (i,t,a) #v# (\"%d\",\"Read Fail(Ring)\",\"%08o\");\n",
-				(int)instr_counter,addr);
-			return(0); /* TODO:: We should rethink MemoryRead to handle errors more gracefully. */
-//			error=true;
-		}
+	/* Get physical page number */
+	ppn = (sexi) ? PTe & 0x3fff : PTe & 0x01ff;
+	if (((ulong)ppn<<10) >= ND_Memsize) {
+		interrupt(14,1<<9); /* Memory out of range, not a fault so the instruction is not restarted */
+		if (trace & 0x08) fprintf(tracefile,
+			"#m (i,t,a) #v# (\"%d\",\"%s Fail(MOR)\",\"%08o\");\n",
+			(int)instr_counter,what,addr);
+		return NULL;
+	}
 
-//		if (error) return;
+	/* Mark that the page was used, and written if this is a write */
+	gPT->pt[pt_num][vpn] |= (perm == TLB_WRITE) ? ((ulong)0x03<<27) : ((ulong)0x01<<27); /* Set WIP and PGU, or PGU */
 
-		/* Mark that the page was used */
-		gPT->pt[pt_num][vpn] |= ((ulong)0x01<<27); /* Set PGU */
+	TLB_Fill(vpn,apt,ppn,perm);
 
-		/* Get physical page number */
-		ppn = (STS_SEXI) ? PTe & 0x3fff : PTe & 0x01ff;
+	if (trace & 0x08) fprintf(tracefile,
+		"#m (i,t,a) #v# (\"%d\",\"%s (PT)\",\"%08o\");\n",
+		(int)instr_counter,what,addr);
+	return &VolatileMemory->n_Pages[ppn][addr & (((ushort)1<<10) - 1)];
+}
 
-//		if (debug) fprintf(debugfile,"ReadMemory: OK, PTe=%08x pt_num=%d vpn=%d ppn=%04x\n",PTe,pt_num,vpn,ppn);
-//		if (debug) fprintf(debugfile,"ReadMemory: OK, gPT->pt[pt_num][vpn]=%08x\n",gPT->pt[pt_num][vpn]);
+/*
+ * Shadow memory (the page tables) is visible at the top of the address space
+ * in ring 3 or with paging off.
+ */
+static inline __attribute__((always_inline)) bool mem_is_shadow(ushort addr, const bool sexi) {
+	return addr >= ((sexi) ? 0177000 : 0177400);
+}
 
-		if (trace & 0x08) fprintf(tracefile,
-			"#m (i,t,a) #v# (\"%d\",\"Read (PT)\",\"%08o\");\n",
-			(int)instr_counter,addr);
-		return VolatileMemory.n_Pages[ppn][addr & (((ushort)1<<10) - 1)];
-	} else {
-		if (trace & 0x08) fprintf(tracefile,
-			"#m (i,t,a) #v# (\"%d\",\"Read ()\",\"%08o\");\n",
-			(int)instr_counter,addr);
-		return VolatileMemory.n_Array[addr];	/* Only 16 address bits in POF mode */
+/*
+ * PON accessors, used on a TLB miss. Shadow memory first, then the page tables.
+ */
+static inline __attribute__((always_inline)) ushort *mem_lookup_pon(ushort addr, bool UseAPT, const bool sexi, const unsigned char perm, bool *shadow) {
+	*shadow = false;
+	if (((gReg->reg_PCR[CurrLEVEL] & 0x03) == 3) && mem_is_shadow(addr,sexi)) {
+		*shadow = true;
+		return NULL;
 	}
+	return mem_translate(addr,UseAPT,sexi,perm);
 }
 
-ushort MemoryFetch(ushort addr, bool UseAPT) {
-	ushort pcr = gReg->reg_PCR[CurrLEVEL];
-	unsigned char ring_num = pcr & 0x03;
-	ulong PTe;
-	ushort res;
-	unsigned char vpn = addr>>10;
-	ushort ppn;
-	unsigned char pt_num;
-//	bool error = false;
+static inline __attribute__((always_inline)) ushort mem_read_pon(ushort addr, bool UseAPT, const bool sexi, const unsigned char perm) {
+	bool shadow;
+	ushort *p = mem_lookup_pon(addr,UseAPT,sexi,perm,&shadow);
+	if (p) return *p;
+	if (shadow) return PT_Read(addr); /* Read from PageTables!!! */
+	return(0); /* TODO:: We should rethink MemoryRead to handle errors more gracefully. */
+}
 
-	/* just debug the virtual address for now. later on we got to get the real address I think */
-	/* this is for now so we can get output of all memory accesses in a program and debug instructions at full speed */
-//	if (trace) AddMemTrace((unsigned int)addr,'F');
+static inline __attribute__((always_inline)) void mem_write_pon(ushort value, ushort addr, bool UseAPT, unsigned char byte_select, const bool sexi) {
+	bool shadow;
+	ushort *p = mem_lookup_pon(addr,UseAPT,sexi,TLB_WRITE,&shadow);
+	if (p)
+		mem_store(p,value,byte_select);
+	else if (shadow)
+		PT_Write(value,addr,byte_select); /* Write to PageTables!!! */
+}
 
-	/* First we check if Shadow Memory is accessible. */
-	if(IsShadowMemAccess((ulong)addr)) { /* Read from PageTables!!! */
-		res = PT_Read(addr);
-		return(res); /* PT data */
-	}
+static ushort MemoryRead_PON(ushort addr, bool UseAPT) { return mem_read_pon(addr,UseAPT,false,TLB_READ); }
+static ushort MemoryFetch_PON(ushort addr, bool UseAPT) { return mem_read_pon(addr,UseAPT,false,TLB_FETCH); }
+static void MemoryWrite_PON(ushort value, ushort addr, bool UseAPT, unsigned char byte_select) { mem_write_pon(value,addr,UseAPT,byte_select,false); }
 
-	if(STS_PONI) {
-		if((STS_PTM) && UseAPT)
-			pt_num = (pcr>>7) & 0x03;	// APT
-		else
-			pt_num = (pcr>>9) & 0x03;	// PT
+static ushort MemoryRead_SEXI(ushort addr, bool UseAPT) { return mem_read_pon(addr,UseAPT,true,TLB_READ); }
+static ushort MemoryFetch_SEXI(ushort addr, bool UseAPT) { return mem_read_pon(addr,UseAPT,true,TLB_FETCH); }
+static void MemoryWrite_SEXI(ushort value, ushort addr, bool UseAPT, unsigned char byte_select) { mem_write_pon(value,addr,UseAPT,byte_select,true); }
 
-		PTe = gPT->pt[pt_num][vpn];
+/*
+ * POF accessors, used on a TLB miss. Only 16 address bits and no translation,
+ * so the page is entered in the TLB as is. Shadow memory is always visible.
+ * With less than 64KWords installed, the top of the space is out of range.
+ */
+static inline bool mem_pof_mor(ushort addr) {
+	if (addr < ND_Memsize)
+		return false;
+	interrupt(14,1<<9); /* Memory out of range */
+	return true;
+}
 
-		/* Check if not FPM(Fetch Permit bit is not set) */
-		if (!(PTe & ((ulong)1<<29))) {
-// 			debug=1; /* PT DEBUGGING: remove once finished */
-			gPGS = ((ushort)3<<14) | ((ushort)pt_num<<6) | vpn;
-			if (!(PTe & ((ulong)0x07<<29)))
-				interrupt(14,1<<3); /* Page Fault */
-			else
-				interrupt(14,1<<2); /* Memory Protection Violation */
-			if (trace & 0x08) fprintf(tracefile,
-				"#m (i,t,a) #v# (\"%d\",\"Fetch Fail(FPM)\",\"%08o\");\n",
-				(int)instr_counter,addr);
-			return(0); /* TODO:: We should rethink MemoryFetch to handle errors more gracefully. */
-//			error = true;
-		}
+static ushort MemoryRead_POF(ushort addr, bool UseAPT) {
+	if (mem_is_shadow(addr,STS_SEXI)) return PT_Read(addr); /* Read from PageTables!!! */
+	if (mem_pof_mor(addr)) return 0;
+	if (trace & 0x08) fprintf(tracefile,
+		"#m (i,t,a) #v# (\"%d\",\"Read ()\",\"%08o\");\n",
+		(int)instr_counter,addr);
+	TLB_Fill(addr>>10,(STS_PTM) && UseAPT,addr>>10,TLB_READ);
+	return VolatileMemory->n_Array[addr];
+}
 
-		/* Check if ring number is too low */
-		if(((PTe>>24) & 0x03) > ring_num) {
-// 			debug=1; /* PT DEBUGGING: remove once finished */
-			gPGS = ((ushort)1<<15) | ((ushort)pt_num<<6) | vpn;
-			interrupt(14,1<<2); /* Ring Protection Violation */
-			if (trace & 0x08) fprintf(tracefile,
-				"#m (i,t,a) #v# (\"%d\",\"Fetch Fail(Ring)\",\"%08o\");\n",
-				(int)instr_counter,addr);
-			return(0); /* TODO:: We should rethink MemoryFetch to handle errors more gracefully. */
-//			error = true;
-		}
+static ushort MemoryFetch_POF(ushort addr, bool UseAPT) {
+	if (mem_is_shadow(addr,STS_SEXI)) return PT_Read(addr); /* Read from PageTables!!! */
+	if (mem_pof_mor(addr)) return 0;
+	if (trace & 0x08) fprintf(tracefile,
+		"#m (i,t,a) #v# (\"%d\",\"Fetch ()\",\"%08o\");\n",
+		(int)instr_counter,addr);
+	TLB_Fill(addr>>10,(STS_PTM) && UseAPT,addr>>10,TLB_FETCH);
+	return VolatileMemory->n_Array[addr];
+}
 
-//		if (error) return;
+static void MemoryWrite_POF(ushort value, ushort addr, bool UseAPT, unsigned char byte_select) {
+	if (mem_is_shadow(addr,STS_SEXI)) {
+		PT_Write(value,addr,byte_select); /* Write to PageTables!!! */
+		return;
+	}
+	if (mem_pof_mor(addr)) return;
+	if (trace & 0x08) fprintf(tracefile,
+		"#m (i,t,a) #v# (\"%d\",\"Write ()\",\"%08o\");\n",
+		(int)instr_counter,addr);
+	TLB_Fill(addr>>10,(STS_PTM) && UseAPT,addr>>10,TLB_WRITE);
+	mem_store(&VolatileMemory->n_Array[addr],value,byte_select);
+}
 
-		/* Mark that the page was used */
-		gPT->pt[pt_num][vpn] |= ((ulong)0x01<<27); /* Set PGU */
+static const struct MemOps MemOps_POF = { MemoryRead_POF, MemoryFetch_POF, MemoryWrite_POF };
+static const struct MemOps MemOps_PON = { MemoryRead_PON, MemoryFetch_PON, MemoryWrite_PON };
+static const struct MemOps MemOps_SEXI = { MemoryRead_SEXI, MemoryFetch_SEXI, MemoryWrite_SEXI };
 
-		/* Get physical page number */
-		ppn = (STS_SEXI) ? PTe & 0x3fff : PTe & 0x01ff;
+/*
+ * MemModeSync - Select the TLB miss accessors for the current PONI/SEXI state.
+ * Called from HotStateSync, which runs on every PON/POF/SEX/REX and level change.
+ * PCR changes need no switch, the ring and page table are only looked at on a TLB miss.
+ */
+void MemModeSync(void) {
+	gMem = (!gHot.poni) ? &MemOps_POF : (gHot.sexi) ? &MemOps_SEXI : &MemOps_PON;
+}
 
-//		if (debug) fprintf(debugfile,"FetchMemory: OK, PTe=%08x pt_num=%d vpn=%d ppn=%04x\n",PTe,pt_num,vpn,ppn);
-//		if (debug) fprintf(debugfile,"FetchMemory: OK, gPT->pt[pt_num][vpn]=%08x\n",gPT->pt[pt_num][vpn]);
+/*
+ * Write a word to memory.
+ * Here we implement all Memory Management System functions.
+ * A TLB hit is the same in every mode. Misses go to the accessors
+ * for the current mode.
+ */
+void MemoryWrite(ushort value, ushort addr, bool UseAPT, unsigned char byte_select) {
+	struct TLBEntry *tlb = &gTLB[CurrLEVEL][((STS_PTM) && UseAPT) ? 1 : 0][addr>>10];
+	if (tlb->perm & TLB_WRITE) /* Already translated, checked and marked */
+		mem_store(&tlb->page[addr & (((ushort)1<<10) - 1)],value,byte_select);
+	else
+		gMem->write(value,addr,UseAPT,byte_select);
+}
 
-		if (trace & 0x08) fprintf(tracefile,
-			"#m (i,t,a) #v# (\"%d\",\"Fetch (PT)\",\"%08o\");\n",
-			(int)instr_counter,addr);
-		return VolatileMemory.n_Pages[ppn][addr & (((ushort)1<<10) - 1)];
-	} else {
-		if (trace & 0x08) fprintf(tracefile,
-			"#m (i,t,a) #v# (\"%d\",\"Fetch ()\",\"%08o\");\n",
-			(int)instr_counter,addr);
-		return VolatileMemory.n_Array[addr];	/* Only 16 address bits in POF mode */
-	}
+/*
+ * Read a word from memory.
+ * Here we implement all Memory Management System functions.
+ */
+ushort MemoryRead(ushort addr, bool UseAPT) {
+	struct TLBEntry *tlb = &gTLB[CurrLEVEL][((STS_PTM) && UseAPT) ? 1 : 0][addr>>10];
+	if (tlb->perm & TLB_READ) /* Already translated, checked and marked */
+		return tlb->page[addr & (((ushort)1<<10) - 1)];
+	return gMem->read(addr,UseAPT);
 }
 
-void cpurun(){
-	int s;
-	ushort operand, p_now;
-	char disasm_str[256];
+ushort MemoryFetch(ushort addr, bool UseAPT) {
+	struct TLBEntry *tlb = &gTLB[CurrLEVEL][((STS_PTM) && UseAPT) ? 1 : 0][addr>>10];
+	if (tlb->perm & TLB_FETCH) /* Already translated, checked and marked */
+		return tlb->page[addr & (((ushort)1<<10) - 1)];
+	return gMem->fetch(addr,UseAPT);
+}
+
+/*
+ * cpurun_body - The interpreter loop.
+ * Always inlined with a constant instrumented flag, so cpurun_fast gets
+ * the trace, disasm and pair statistics hooks compiled out, and
+ * cpurun_instr keeps them (still checking which ones are on).
+ * Pending device events are run between instructions.
+ */
+static inline __attribute__((always_inline)) void cpurun_body(const bool instrumented) {
+	ushort operand;
 //	debug=0; /* PT DEBUGGING: remove once finished */
 	prefetch(); /* works because gPC should already be setup when cpurun is called */
 	gReg->myreg_IR = gReg->myreg_PFB;
@@ -3654,31 +3835,62 @@ void cpurun(){
 				}
 		}
 		instr_counter++;
-		if (trace) trace_pre(1,"S",gReg->reg[CurrLEVEL][0]);
+		if (instrumented && trace) {
+			LazyFlagSync();
+			trace_pre(1,"S",gReg->reg[CurrLEVEL][0]);
+		}
 		operand=gReg->myreg_IR;
 //		operand=MemoryFetch(gPC,true);
-		p_now=gPC;
-		if (trace) trace_instr(operand);
-		if (DISASM) disasm_instr(gPC,operand);
+		if (instrumented) {
+			if (trace) trace_instr(operand);
+			if (DISASM) disasm_instr(gPC,operand);
+			if (PAIRSTATS) pairstat_add(operand);
+		}
 		do_op(operand);
-		if (trace & 0x16) trace_regs();
+		if (instrumented && (trace & 0x16)) {
+			LazyFlagSync();
+			trace_regs();
+		}
+		if (instr_counter >= gEventNext)
+			EventRun(); /* device events due, may raise interrupts */
+		if (__atomic_load_n(&gIntPending,__ATOMIC_RELAXED) && __atomic_exchange_n(&gIntPending,false,__ATOMIC_ACQ_REL)) {
+			checkPK(); /* PID or PIE changed since last instruction */
+			if (__atomic_load_n(&gSnapReq,__ATOMIC_ACQUIRE))
+				SnapshotTake(); /* asked for by signal or mopc */
+		}
 		if(STS_IONI && (gPK != gPIL)) { /* Time to change runlevel */
-			while ((s = sem_wait(&sem_int)) == -1 && errno == EINTR) /* wait for interrupt lock to be free */
-				continue; /* Restart if interrupted by handler */
 			gPVL = gPIL; /* Save current runlevel */
 			setPIL(gPK); /* Change to new runlevel */
-			if (sem_post(&sem_int) == -1) { /* release interrupt lock */
-				if (debug) fprintf(debugfile,"ERROR!!! sem_post failure DOMCL\n");
-				CurrentCPURunMode = SHUTDOWN;
-			}
 			prefetch(); /* Ok, since we are changing runlevel, we chuck old prefetched instruction and fetch a new one. */
 		}
-		if (trace) trace_post(1,"S",gReg->reg[CurrLEVEL][0]);
-		if (trace) trace_flush();
+		if (instrumented && trace) {
+			LazyFlagSync();
+			trace_post(1,"S",gReg->reg[CurrLEVEL][0]);
+			trace_flush();
+		}
 		gReg->myreg_IR = gReg->myreg_PFB; /* prefetch of next instruction should have been done while executing current one. */
 	}
 }
 
+static void cpurun_fast(void) {
+	cpurun_body(false);
+}
+
+static void cpurun_instr(void) {
+	cpurun_body(true);
+}
+
+/*
+ * Run the cpu until stopped. trace, DISASM and pairstats are only set
+ * from the config file at startup, so pick the loop variant once here.
+ */
+void cpurun(){
+	if (trace || DISASM || PAIRSTATS)
+		cpurun_instr();
+	else
+		cpurun_fast();
+}
+
 void cpu_thread(){
 	int s;
 	if (debug) fprintf(debugfile,"(##)cpu_thread running...\n");
@@ -3690,6 +3902,7 @@ void cpu_thread(){
 
 	while (CurrentCPURunMode != SHUTDOWN) {
 		if(CurrentCPURunMode != STOP) cpurun();
+		LazyFlagSync(); /* so STS is right for anyone looking while we are stopped */
 
 		/* signal that we are now stopped and the routine waiting on us can continue */
 		if(CurrentCPURunMode != SHUTDOWN) {
@@ -3705,48 +3918,14 @@ void cpu_thread(){
 	}
 }
 
- void AddIdentChain(char lvl, ushort identnum, int callerid){
-	struct IdentChain *curr, *new;
-	new=calloc(1,sizeof(struct IdentChain));
-	new->identcode = identnum;
-	new->level = lvl;
-	new->callerid = callerid;
-
-	curr=gIdentChain;
-
-	if(curr != NULL ) {
-		while (curr->next != NULL) {
-			if  (curr->callerid == callerid){ /* We have already registered once, so exit */
-				free(new);
-				return;
-			}
-			curr=curr->next;
-		}
-	} else {
-		gIdentChain=new;
-		return;
-	}
-	curr->next=new;
-	new->prev=curr;
-}
-
-void RemIdentChain(struct IdentChain * elem){
-	struct IdentChain *p, *n;
-	n=elem->next;
-	p=elem->prev;
-	/* Unlink this element */
-	if(n && p) {
-		p->next=n;
-		n->prev=p;
-	} else if (n){
-		n->prev=NULL;
-		gIdentChain=n;
-	} else if (p) {
-		p->next=NULL;
-	} else {
-		gIdentChain=NULL;
-	}
-	free(elem);
+/*
+ * IdentPost - Make a device answer IDENT on level lvl (10-13).
+ * Safe to call from any thread. Post before raising the interrupt
+ * so the ident is there when the cpu gets to the IDENT instruction.
+ */
+void IdentPost(char lvl, ushort identnum) {
+	identnum &= 0x1ff;
+	__atomic_or_fetch(&gIdent[IDENT_LEVEL(lvl)][identnum>>6],1ULL<<(identnum & 0x3f),__ATOMIC_RELEASE);
 }
 
 void AddMemTrace(unsigned int addr, char whom){
@@ -3813,6 +3992,8 @@ void Instruction_Add(int start, int stop, void *funcpointer) {
  * This also thus actually acts as the new instruction parser also.
  */
 void Setup_Instructions () {
+	Setup_EffectiveAddr();
+
 	Instruction_Add(0000000,0177777,&ndfunc_stz);			/* First make all instructions by default point to illegal_instr  */
 
 	Instruction_Add(0000000,0003777,&ndfunc_stz);			/* STZ  */
@@ -3857,11 +4038,21 @@ void Setup_Instructions () {
 	Instruction_Add(0140120,0140120,&unimplemented_instr);		/* ADDD  */
 	Instruction_Add(0140121,0140121,&unimplemented_instr);		/* SUBD  */
 	Instruction_Add(0140122,0140122,&unimplemented_instr);		/* COMD  */
-	Instruction_Add(0140123,0140123,&unimplemented_instr);		/* TSET  */
 	Instruction_Add(0140124,0140124,&unimplemented_instr);		/* PACK  */
 	Instruction_Add(0140125,0140125,&unimplemented_instr);		/* UPACK */
 	Instruction_Add(0140126,0140126,&unimplemented_instr);		/* SHDE  */
-	Instruction_Add(0140127,0140127,&unimplemented_instr);		/* RDUS  */
+	switch(CurrentCPUType){
+	case ND100CX:
+	case ND110CX:
+	case ND110PCX:
+		Instruction_Add(0140123,0140123,&ndfunc_tset);		/* TSET  - CX option */
+		Instruction_Add(0140127,0140127,&ndfunc_rdus);		/* RDUS  - CX option */
+		break;
+	default:
+		Instruction_Add(0140123,0140123,&unimplemented_instr);	/* TSET  */
+		Instruction_Add(0140127,0140127,&unimplemented_instr);	/* RDUS  */
+		break;
+	}
 	Instruction_Add(0140130,0140130,&ndfunc_bfill);			/* BFILL */
 	Instruction_Add(0140131,0140131,&DoMOVB);			/* MOVB  */
 	Instruction_Add(0140132,0140132,&DoMOVBF);			/* MOVBF */
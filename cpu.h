@@ -49,6 +49,7 @@ char *bop_str[] = {"BSET ZRO","BSET ONE","BSET BCM","BSET BAC","BSKP ZRO","BSKP
 extern FILE *tracefile;
 extern int trace;
 extern int DISASM;
+extern int PAIRSTATS;
 
 extern FILE *debugfile;
 extern int debug;
@@ -62,17 +63,27 @@ extern int emulatemon;
 
 /* NOTE: Memory part not implemented yet!! */
 
-_NDRAM_		VolatileMemory;
+_NDRAM_		*VolatileMemory;
 _NDPT_		PageTable;
 _RUNMODE_	CurrentCPURunMode;
 _CPUTYPE_	CurrentCPUType;
 
 struct CpuRegs *gReg;
+struct CpuHot gHot;
+struct LazyFlags gLazy;
+const struct MemOps *gMem;	/* accessors for the current paging mode, see MemModeSync */
+bool gMemFault;	/* set when a memory access raised a page fault or protection violation */
+bool gIntPending;	/* set by interrupt() and PID/PIE writers, polled in cpurun */
+bool gIdle;		/* cpu thread is (about to be) blocked on sem_idle */
+int IDLE;		/* block the cpu thread in guest idle loops */
 union NewPT *gPT;
+struct TLBEntry gTLB[16][2][64];	/* [level][APT][vpn] */
 struct MemTraceList *gMemTrace;
-struct IdentChain *gIdentChain;
+unsigned long long gIdent[4][IDENT_WORDS];	/* [level-10][ident code/64] */
+unsigned long long gDirty[DIRTY_WORDS];	/* physical pages written since the last checkpoint */
 
-#define ND_Memsize	(sizeof(VolatileMemory)/sizeof(ushort))
+ulong ND_Memsize = MEMPTSIZE*1024;	/* installed memory in words, "memsize" in the config */
+int HUGEPAGES;	/* back guest memory with huge pages */
 
 /*
  * NEW INSTRUCTION HANDLING!!
@@ -171,6 +182,8 @@ void ndfunc_jxn(ushort operand);
 void ndfunc_jpl(ushort operand);
 void ndfunc_skp(ushort operand);
 void ndfunc_bfill(ushort operand);
+void ndfunc_tset(ushort operand);
+void ndfunc_rdus(ushort operand);
 void ndfunc_init(ushort operand);
 void ndfunc_entr(ushort operand);
 void ndfunc_leave(ushort operand);
@@ -216,6 +229,8 @@ void setreg(int r, int val);
 void do_debug_txt(char *txt);
 void debug_regs(void);
 void setbit_STS_MSB(ushort stsbit, char val);
+void HotStateSync(void);
+void LazyFlagSync(void);
 void AdjustSTS(ushort reg_a, ushort operand, int result);
 void clrbit(unsigned short regnum, unsigned short stsbit);
 void setbit(unsigned short regnum, unsigned short stsbit, char val);
@@ -227,6 +242,7 @@ void setcbreak (void);
 bool IsSkip(ushort instr);
 ushort GetEffectiveAddr(ushort instr);
 ushort New_GetEffectiveAddr(ushort instr, bool *use_apt);
+void Setup_EffectiveAddr();
 void PT_Write(ushort value, ushort addr, ushort byte_select);
 ushort PT_Read(ushort addr);
 void PhysMemWrite(ushort value, ulong addr);
@@ -234,13 +250,19 @@ ushort PhysMemRead(ulong addr);
 void MemoryWrite(ushort value, ushort addr, bool is_P_relative, unsigned char byte_select);
 ushort MemoryRead(ushort addr, bool is_P_relative);
 ushort MemoryFetch(ushort addr, bool is_P_relative);
+void MemModeSync(void);
+void TLB_Flush(void);
+void TLB_FlushLevel(ushort level);
+void TLB_FlushPage(unsigned char vpn);
+void TLB_Fill(unsigned char vpn, bool apt, ushort ppn, unsigned char perm);
 void AddMemTrace(unsigned int addr, char whom);
 void DelMemTrace();
 void PrintMemTrace();
-void AddIdentChain(char lvl, ushort identnum, int callerid);
-void RemIdentChain(struct IdentChain * elem);
+void IdentPost(char lvl, ushort identnum);
 void checkPK (void);
 void interrupt(ushort lvl,ushort sub);
+void CpuIdle(void);
+void CpuWake(void);
 void illegal_instr(ushort operand);
 void unimplemented_instr(ushort operand);
 void prefetch();
@@ -276,6 +298,17 @@ extern void disasm_exr(ushort addr, ushort instr);
 extern void disasm_setlbl(ushort addr);
 extern void disasm_userel(ushort addr, ushort where);
 extern void disasm_set_isdata(ushort addr);
+extern void pairstat_add(ushort instr);
 
 extern sem_t sem_pap;
 extern struct display_panel *gPAP;
+extern struct rtc_data *sys_rtc;
+extern int RTC_VIRTUAL;
+extern double gEventNext;
+extern void EventRun(void);
+extern void EventSkip(void);
+extern bool gSnapReq;
+extern char *SNAPSHOT_FILE;
+extern int SnapshotSave(char *filename);
+extern void SnapshotRequest(void);
+extern void SnapshotTake(void);
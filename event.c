@@ -0,0 +1,172 @@
+/*
+ * nd100em - ND100 Virtual Machine
+ *
+ * Copyright (c) 2006-20011 Roger Abrahamsson
+ *
+ * This file is originated from the nd100em project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (in the main directory of the nd100em
+ * distribution in the file COPYING); if not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <math.h>
+#include "event.h"
+
+/*
+ * Discrete event scheduler for device timing.
+ * Devices queue a handler to run a number of instructions from now, and
+ * the cpu loop runs it at the first instruction boundary at or after that.
+ * Only used from the cpu thread, so there is no locking.
+ */
+
+static void event_swap(int a, int b) {
+	struct Event tmp = gEvents[a];
+	gEvents[a] = gEvents[b];
+	gEvents[b] = tmp;
+}
+
+static void event_up(int i) {
+	while (i > 0 && gEvents[(i-1)/2].when > gEvents[i].when) {
+		event_swap(i,(i-1)/2);
+		i = (i-1)/2;
+	}
+}
+
+static void event_down(int i) {
+	int c;
+	while ((c = 2*i+1) < gEventCount) {
+		if ((c+1 < gEventCount) && (gEvents[c+1].when < gEvents[c].when))
+			c++;
+		if (gEvents[i].when <= gEvents[c].when)
+			break;
+		event_swap(i,c);
+		i = c;
+	}
+}
+
+static void event_remove(int i) {
+	gEventCount--;
+	if (i != gEventCount) {
+		gEvents[i] = gEvents[gEventCount];
+		event_down(i);
+		event_up(i);
+	}
+	gEventNext = (gEventCount) ? gEvents[0].when : HUGE_VAL;
+}
+
+static void event_add(double delay, void (*func)(int), int arg, bool counted) {
+	if (gEventCount >= EVENT_MAX) {
+		if (debug) fprintf(debugfile,"ERROR!!! event queue full, event dropped\n");
+		return;
+	}
+	gEvents[gEventCount].when = instr_counter + delay;
+	gEvents[gEventCount].func = func;
+	gEvents[gEventCount].arg = arg;
+	gEvents[gEventCount].counted = counted;
+	event_up(gEventCount++);
+	gEventNext = gEvents[0].when;
+}
+
+/*
+ * EventAdd - Run device event func(arg) delay instructions from now.
+ */
+void EventAdd(double delay, void (*func)(int), int arg) {
+	event_add(delay,func,arg,false);
+}
+
+/*
+ * EventAddCounted - Run func(arg) after exactly delay more instructions,
+ * even when device time is skipped ahead in between.
+ */
+void EventAddCounted(double delay, void (*func)(int), int arg) {
+	event_add(delay,func,arg,true);
+}
+
+/*
+ * EventCancel - Forget all pending func(arg) events.
+ */
+void EventCancel(void (*func)(int), int arg) {
+	int i = 0;
+	while (i < gEventCount) {
+		if ((gEvents[i].func == func) && (gEvents[i].arg == arg))
+			event_remove(i);	/* moves another event into i, so look again */
+		else
+			i++;
+	}
+}
+
+/*
+ * EventRun - Run all events that are due. Handlers may queue new events.
+ */
+void EventRun(void) {
+	struct Event ev;
+	while (gEventCount && (gEvents[0].when <= instr_counter)) {
+		ev = gEvents[0];
+		event_remove(0);
+		ev.func(ev.arg);
+	}
+}
+
+/*
+ * EventAdvance - Let delta instructions worth of time pass at once for the
+ * devices, used for things like the IOX timeout that take time but no
+ * instructions. Counted events stay where they are.
+ */
+void EventAdvance(double delta) {
+	int i;
+	for (i = 0; i < gEventCount; i++)
+		if (!gEvents[i].counted)
+			gEvents[i].when -= delta;
+	for (i = gEventCount/2 - 1; i >= 0; i--)	/* only some moved, so heap them again */
+		event_down(i);
+	gEventNext = (gEventCount) ? gEvents[0].when : HUGE_VAL;
+}
+
+/*
+ * EventSkip - Nothing to do until the next device event, so make it due now.
+ */
+void EventSkip(void) {
+	double next = HUGE_VAL;
+	int i;
+	for (i = 0; i < gEventCount; i++)
+		if (!gEvents[i].counted && (gEvents[i].when < next))
+			next = gEvents[i].when;
+	if (next != HUGE_VAL && (next > instr_counter))
+		EventAdvance(next - instr_counter);
+}
+
+/*
+ * EventPeek - Look at pending event i (in no particular order),
+ * used to save them in a snapshot. False when there is no event i.
+ */
+bool EventPeek(int i, double *when, void (**func)(int), int *arg) {
+	if ((i < 0) || (i >= gEventCount))
+		return false;
+	*when = gEvents[i].when;
+	*func = gEvents[i].func;
+	*arg = gEvents[i].arg;
+	return true;
+}
+
+/*
+ * EventClear - Forget all pending events, before restoring a snapshot.
+ */
+void EventClear(void) {
+	gEventCount = 0;
+	gEventNext = HUGE_VAL;
+}
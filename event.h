@@ -0,0 +1,53 @@
+/*
+ * nd100em - ND100 Virtual Machine
+ *
+ * Copyright (c) 2006-20011 Roger Abrahamsson
+ *
+ * This file is originated from the nd100em project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (in the main directory of the nd100em
+ * distribution in the file COPYING); if not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Pending device events, a binary heap ordered on when they are due.
+ * Times are in executed instructions (instr_counter). Device timing
+ * moves when time is skipped, instruction count triggers do not.
+ */
+#define EVENT_MAX	32
+
+struct Event {
+	double when;		/* instr_counter value to fire at */
+	void (*func)(int);	/* handler, called from the cpu loop */
+	int arg;
+	bool counted;		/* fires at an instruction count, time skips leave it alone */
+};
+
+struct Event gEvents[EVENT_MAX];
+int gEventCount = 0;
+double gEventNext = HUGE_VAL;	/* when of gEvents[0], cached for the cpu loop */
+
+extern double instr_counter;
+extern int debug;
+extern FILE *debugfile;
+
+void EventAdd(double delay, void (*func)(int), int arg);
+void EventAddCounted(double delay, void (*func)(int), int arg);
+void EventCancel(void (*func)(int), int arg);
+void EventRun(void);
+void EventAdvance(double delta);
+void EventSkip(void);
+bool EventPeek(int i, double *when, void (**func)(int), int *arg);
+void EventClear(void);
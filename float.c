@@ -25,7 +25,6 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <pthread.h>
-#include <math.h>
 #include "nd100.h"
 
 int MUL32 (unsigned long int* a, unsigned long int* b, unsigned long int* r);
@@ -33,26 +32,16 @@ int NDFloat_Div (unsigned short int* p_a,unsigned short int* p_b,unsigned short
 int NDFloat_Mul (unsigned short int* p_a,unsigned short int* p_b,unsigned short int* p_r);
 int NDFloat_Add (unsigned short int* p_a,unsigned short int* p_b,unsigned short int* p_r);
 int NDFloat_Sub (unsigned short int* p_a,unsigned short int* p_b,unsigned short int* p_r);
-long double pow2l(int i);
 
 extern double instr_counter;
 extern int debug;
 extern FILE *debugfile;
 extern struct CpuRegs *gReg;
+extern struct CpuHot gHot;
 void DoNLZ (char scaling);
 void DoDNZ (char scaling);
 extern void setbit(ushort regnum, ushort stsbit, char val);
 
-/* routine to sort out a missing powl in freebsd */
-long double pow2l(int i){
-	long double r;
-#if !(defined __FreeBSD__ || defined BSD )
-	r=powl(2,(long double)i);
-#else
-#endif
-	return r;
-}
-
 /*
  * int MUL32(unsigned long int* a, unsigned long int* b, unsigned long int* r)
  * Multiplies two 32 bit numbers. The result is accomodated in 64 bits(Big Endian arrangement).
@@ -294,6 +283,51 @@ int old_NDFloat_Mul(unsigned short int* p_a,unsigned short int* p_b,unsigned sho
 	return 0;
 }
 
+/*
+ * nd_float_exp, nd_float_mant
+ * Exponent without offset and 32 bit mantissa of an ND float in T,A,D order.
+ */
+static inline int nd_float_exp(ushort *p) {
+	return (int)(p[0] & 0x7fff) - (1<<14);
+}
+
+static inline unsigned int nd_float_mant(ushort *p) {
+	return ((unsigned int)p[1] << 16) | p[2];
+}
+
+/*
+ * nd_float_pack
+ * Store sign, exponent (without offset) and a normalised 32 bit mantissa as an ND float.
+ * A zero mantissa gives the ND standard 0. Exponent overflow and underflow are
+ * handled like NDFloat_Add does, returning -2 and -3.
+ */
+static int nd_float_pack(bool sign, int exp, unsigned int mant, ushort *p_r) {
+	if (mant == 0) {
+		p_r[0] = 0;
+		p_r[1] = 0;
+		p_r[2] = 0;
+		return 0;
+	}
+	if (exp > ((1<<14) - 1)) {
+		/* Overflow */
+		p_r[0] = ((sign) ? ((unsigned short int)1<<15) : 0) | 0x7FFF;
+		p_r[1] = 0xFFFF;
+		p_r[2] = 0xFFFF;
+		return -2;
+	}
+	if (exp < -(1<<14)) {
+		/* :TODO: Underflow */
+		p_r[0] = ((sign) ? ((unsigned short int)1<<15) : 0);
+		p_r[1] = 0;
+		p_r[2] = 0;
+		return -3;
+	}
+	p_r[0] = ((sign) ? ((unsigned short int)1<<15) : 0) | ((unsigned)exp + ((unsigned short int)1<<14));
+	p_r[1] = mant >> 16;
+	p_r[2] = mant & 0xFFFF;
+	return 0;
+}
+
 /*
  * int NDFloat_Add(unsigned short int* p_a,unsigned short int* p_b,unsigned short int* p_r)
  * Emulates ND 48 bit float addition.
@@ -308,7 +342,8 @@ int old_NDFloat_Mul(unsigned short int* p_a,unsigned short int* p_b,unsigned sho
 
 int NDFloat_Add(ushort* p_a,ushort* p_b,ushort* p_r) {
 	bool sign_a,sign_b,sign_r;
-	bool is_exact, do_nlz;
+	bool is_exact;
+	int res;
 	int exp_a, exp_b, exp_r;
 	unsigned  int delta_e;
 	unsigned int a, b, r;
@@ -333,16 +368,16 @@ int NDFloat_Add(ushort* p_a,ushort* p_b,ushort* p_r) {
 	if(exp_a > exp_b) {
 		delta_e = exp_a - exp_b;
 		/* We will shift b right by delta_e, so check if we will shift out any ones first */
-		if (b & (~(0xffffffff << delta_e)))
+		if ((delta_e > 31) ? b : (b & (~(0xffffffff << delta_e))))
 			is_exact = false;	/* Yes, take note of it */
-		b = b >> delta_e;
+		b = (delta_e > 31) ? 0 : b >> delta_e;
 		exp_r = exp_a;
 	} else	if(exp_b > exp_a) {
 		delta_e = exp_b - exp_a;
 		/* We will shift a right by delta_e, so check if we will shift out any ones first */
-		if (a & (~(0xffffffff << delta_e)))
+		if ((delta_e > 31) ? a : (a & (~(0xffffffff << delta_e))))
 			is_exact = false;	/* Yes, take note of it */
-		a = a >> delta_e;
+		a = (delta_e > 31) ? 0 : a >> delta_e;
 		exp_r= exp_b;
 	} else {
 		delta_e = 0;
@@ -373,40 +408,12 @@ int NDFloat_Add(ushort* p_a,ushort* p_b,ushort* p_r) {
 
 	/* Normalize result */
 	if ( r != 0 ) {
-		do {
-			do_nlz = (!(r  & 0x80000000)) ? true : false; /* Highest bit is zero.. adjust */
-			if (do_nlz) {
-				r = r << 1;
-				exp_r--;
-			}
-		} while (do_nlz == true);
-	} else {
-		exp_r = 0;
-		sign_r = false;
+		exp_r -= __builtin_clz(r);
+		r <<= __builtin_clz(r);
 	}
-
-	if(exp_r > ((1<<14) - 1)) {
-		/* Overflow */
-		p_r[0] = ((sign_r) ? ((unsigned short int)1<<15) : 0) | 0x7FFF;
-		p_r[1] = 0xFFFF;
-		p_r[2] = 0xFFFF;
-		return -2;
-	}
-	if(exp_r < -(1<<14)) {
-		/* :TODO: Underflow */
-		p_r[0] = ((sign_r) ? ((unsigned short int)1<<15) : 0);
-		p_r[1] = 0;
-		p_r[2] = 0;
-		return -3;
-	}
-
-	p_r[0] = ((sign_r) ? ((unsigned short int)1<<15) : 0) | ((unsigned)exp_r + ((unsigned short int)1<<14));
-	p_r[1] = r >> 16;
-	p_r[2] = (r & 0xFFFF);
-
-	/* Make ND standardized 0 */
-	if ((p_r[0]== 040000) & (p_r[1]== 000000) & (p_r[2]== 000000))
-		p_r[0]= 000000;
+	res = nd_float_pack(sign_r,exp_r,r,p_r);
+	if (res)
+		return res;
 
 	if (is_exact)
 		return 0;
@@ -464,89 +471,22 @@ void old_DoDNZ(char scaling) {
 	gD = 0;
 }
 
-/*
- * ld_to_ndmant
- *
- * converts a long double normalised mantissa
- * to ND100 mantissa 32 bits
- */
-unsigned int ld_to_ndmant(long double mant){
-	int i,j;
-	long double k,l;
-	unsigned int res =0;
-	j=31;
-	i=-1;
-	l=0; k=0;
-	for(i=-1; i>=-32;i--) {
-		l=k+pow2l(i);
-		if (l>mant) { /* 0 in this bit pos */
-			res &= ~(1<<j);
-		} else { /* 1 in this bit pos */
-			res |= 1<<j;
-			k=l;
-		}
-		if (debug) fprintf(debugfile,"ld_to_ndmant: loop: i:%d j:%d l:%.19Lf mant:%.19Lf k:%.19Lf res:%08x\n",i,j,l,mant,k,res);
-		j--;
-	}
-	return res;
-}
-
-/*
- * ndmant_to_ld
- *
- * converts a ND100 mantissa to a long double
- *
- */
-void ndmant_to_ld(unsigned int ndmant, long double *val) {
-	int i,j;
-	long double k,l;
-	j=31;
-	k=0;
-	for(i=-1; i>=-32;i--) {
-		l=((ndmant>>j) &0x01)* pow2l(i);
-		k+=l;
-		j--;
-	}
-	*val = k;
-	return;
-}
-
-
 /*
  * int NDFloat_Div(unsigned short int* p_a,unsigned short int* p_b,unsigned short int* p_r)
  * Emulates ND 48 bit float divide.
- * Parameters p_a - quotient; p_a - divisor; p_r - dividend
+ * Parameters p_a - dividend; p_b - divisor; p_r - quotient
  * All the parameters are organized as arrays of 3, 16 bit elements.
  * The first element contains sign and exponent(reg T), the second MSword of mantisa(reg A), the last LSword of mantisa(reg D).
  * Look in "ND-100 Reference Manual, ND-06.014.02, Revision A" Section 3.1.2.5 for details of 48 bit float format.
+ * The mantissas are divided as integers with 64 extra quotient bits, and the
+ * normalised quotient is truncated to 32 bits.
  * Return value is used to indicate some of exeptions(overflow, underflow etc.)
  */
 int NDFloat_Div(unsigned short int* p_a,unsigned short int* p_b,unsigned short int* p_r) {
-	long double a,b,r;
-	int exp;
-	long double mant;
-	long double k;
-	unsigned int res;
-
-	bool isneg_a = (p_a[0] & 0x8000)>> 15;
-	bool isneg_b = (p_b[0] & 0x8000)>> 15;
-	bool isneg_r = false;
-	if (debug) fprintf(debugfile,"FDV: p_a[0]:%06o p_a[1]:%06o p_a[2]:%06o\n",(int)p_a[0],(int)p_a[1],(int)p_a[2]);
-	if (debug) fprintf(debugfile,"FDV: p_b[0]:%06o p_b[1]:%06o p_b[2]:%06o\n",(int)p_b[0],(int)p_b[1],(int)p_b[2]);
-
-	sshort exp_a = p_a[0] & 0x7fff;
-	exp_a = exp_a - 16384; /* offset for ND100 exp */
-	ndmant_to_ld(((unsigned int)p_a[1]<<16 | p_a[2]), &k);
-	a = k * pow2l((int)exp_a);
-	a = (isneg_a) ? -a : a;
-	if (debug) fprintf(debugfile,"FDV: a:%Lf\n",a);
-
-	sshort exp_b = p_b[0] & 0x7fff;
-	exp_b = exp_b - 16384; /* offset for ND100 exp */
-	ndmant_to_ld(((unsigned int)p_b[1]<<16 | p_b[2]), &k);
-	b = k * pow2l((int)exp_b);
-	b = (isneg_b) ? -b : b;
-	if (debug) fprintf(debugfile,"FDV: b:%Lf\n",b);
+	bool sign_r = ((p_a[0] ^ p_b[0]) & 0x8000) ? true : false;
+	unsigned __int128 q;
+	unsigned long long hi;
+	int lz;
 
 	if ((p_b[1]==0) && (p_b[2]==0)) { /*division by zero */
 		/* TODO:: Mostly guesswork for now */
@@ -554,29 +494,13 @@ int NDFloat_Div(unsigned short int* p_a,unsigned short int* p_b,unsigned short i
 		p_r[1] = 0xffff;
 		p_r[2] = 0xffff;
 		return(1);
-	} else {
-		r= a / b;
-	}
-	if (debug) fprintf(debugfile,"FDV: r:%Lf instr_counter=%d\n",r,(int)instr_counter);
-	mant = frexpl(r,&exp); /* normalise */
-	if (mant < 0) {/* negative number */
-		mant = -mant;
-		isneg_r = true;
 	}
-
-	res = ld_to_ndmant(mant);
-
-	if (debug) fprintf(debugfile,"FDV: res:%d\n",(int)res);
-	p_r[0] = (ushort) 16384 + exp;
-	p_r[0] |= (isneg_r) ? 1<<15 : 0;
-	p_r[1] = (res >> 16) & 0xffff;
-	p_r[2] = res & 0xffff;
-	if ((p_r[2] == 0) &&(p_r[1] == 0)) /* result is 0 */
-		p_r[0] = 0; /* set exp and sign -> 0 too */
-	if (debug) fprintf(debugfile,"FDV: p_r[0]:%06o p_r[1]:%06o p_r[2]:%06o\n",(int)p_r[0],(int)p_r[1],(int)p_r[2]);
-	if (debug) fprintf(debugfile,"FDV: mant:%Lf exp:%d\n",mant,exp);
-	if (debug) fprintf(debugfile,"FDV: ******************************\n");
-	return(0);
+	q = ((unsigned __int128)nd_float_mant(p_a) << 64) / nd_float_mant(p_b);
+	if (q == 0)
+		return nd_float_pack(false,0,0,p_r);
+	hi = (unsigned long long)(q >> 64);
+	lz = (hi) ? __builtin_clzll(hi) : 64 + __builtin_clzll((unsigned long long)q);
+	return nd_float_pack(sign_r,nd_float_exp(p_a) - nd_float_exp(p_b) + 64 - lz,(unsigned int)((q << lz) >> 96),p_r);
 }
 
 /*
@@ -586,106 +510,32 @@ int NDFloat_Div(unsigned short int* p_a,unsigned short int* p_b,unsigned short i
  * All the parameters are organized as arrays of 3, 16 bit elements.
  * The first element contains sign and exponent(reg T), the second MSword of mantisa(reg A), the last LSword of mantisa(reg D).
  * Look in "ND-100 Reference Manual, ND-06.014.02, Revision A" Section 3.1.2.5 for details of 48 bit float format.
+ * The 64 bit mantissa product is normalised and truncated to 32 bits.
  * Return value is used to indicate some of exeptions(overflow, underflow etc.)
  */
 int NDFloat_Mul(unsigned short int* p_a,unsigned short int* p_b,unsigned short int* p_r) {
-	long double a,b,r;
-	int exp;
-	long double mant;
-	long double k;
-	unsigned int res;
-
-	bool isneg_a = (p_a[0] & 0x8000)>> 15;
-	bool isneg_b = (p_b[0] & 0x8000)>> 15;
-	bool isneg_r = false;
-	if (debug) fprintf(debugfile,"FMU: p_a[0]:%06o p_a[1]:%06o p_a[2]:%06o\n",(int)p_a[0],(int)p_a[1],(int)p_a[2]);
-	if (debug) fprintf(debugfile,"FMU: p_b[0]:%06o p_b[1]:%06o p_b[2]:%06o\n",(int)p_b[0],(int)p_b[1],(int)p_b[2]);
-
-	sshort exp_a = p_a[0] & 0x7fff;
-	exp_a = exp_a - 16384; /* offset for ND100 exp */
-	ndmant_to_ld(((unsigned int)p_a[1]<<16 | p_a[2]), &k);
-	a = k * pow2l((int)exp_a);
-	a = (isneg_a) ? -a : a;
-	if (debug) fprintf(debugfile,"FMU: a:%Lf\n",a);
-
-	sshort exp_b = p_b[0] & 0x7fff;
-	exp_b = exp_b - 16384; /* offset for ND100 exp */
-	ndmant_to_ld(((unsigned int)p_b[1]<<16 | p_b[2]), &k);
-	b = k * pow2l((int)exp_b);
-	b = (isneg_b) ? -b : b;
-	if (debug) fprintf(debugfile,"FMU: b:%Lf\n",b);
-
-	r= a * b;
-	if (debug) fprintf(debugfile,"FMU: r:%Lf instr_counter=%d\n",r,(int)instr_counter);
-	mant = frexpl(r,&exp); /* normalise */
-	if (mant < 0) {/* negative number */
-		mant = -mant;
-		isneg_r = true;
-	}
-
-	res = ld_to_ndmant(mant);
-
-	if (debug) fprintf(debugfile,"FMU: res:%d\n",(int)res);
-	p_r[0] = (ushort) 16384 + exp;
-	p_r[0] |= (isneg_r) ? 1<<15 : 0;
-	p_r[1] = (res >> 16) & 0xffff;
-	p_r[2] = res & 0xffff;
-	if ((p_r[2] == 0) &&(p_r[1] == 0)) /* result is 0 */
-		p_r[0] = 0; /* set exp and sign -> 0 too */
-	if (debug) fprintf(debugfile,"FMU: p_r[0]:%06o p_r[1]:%06o p_r[2]:%06o\n",(int)p_r[0],(int)p_r[1],(int)p_r[2]);
-	if (debug) fprintf(debugfile,"FMU: mant:%Lf exp:%d\n",mant,exp);
-	if (debug) fprintf(debugfile,"FMU: ******************************\n");
-	return(0);
+	bool sign_r = ((p_a[0] ^ p_b[0]) & 0x8000) ? true : false;
+	unsigned long long r;
+	int lz;
+
+	r = (unsigned long long)nd_float_mant(p_a) * nd_float_mant(p_b);
+	if (r == 0)
+		return nd_float_pack(false,0,0,p_r);
+	lz = __builtin_clzll(r);
+	return nd_float_pack(sign_r,nd_float_exp(p_a) + nd_float_exp(p_b) - lz,(unsigned int)((r << lz) >> 32),p_r);
 }
 
+/*
+ * int NDFloat_Sub(ushort* p_a, ushort* p_b,ushort* p_r)
+ * Emulates ND 48 bit float subtraction, p_r = p_a - p_b.
+ * Done as an addition with the sign of p_b flipped, so it rounds like FAD.
+ */
 int NDFloat_Sub(ushort* p_a, ushort* p_b,ushort* p_r) {
-	long double a,b,r;
-	int exp;
-	long double mant;
-	long double k;
-	unsigned int res;
-
-	bool isneg_a = (p_a[0] & 0x8000)>> 15;
-	bool isneg_b = (p_b[0] & 0x8000)>> 15;
-	bool isneg_r = false;
-	if (debug) fprintf(debugfile,"FSB: p_a[0]:%06o p_a[1]:%06o p_a[2]:%06o\n",(int)p_a[0],(int)p_a[1],(int)p_a[2]);
-	if (debug) fprintf(debugfile,"FSB: p_b[0]:%06o p_b[1]:%06o p_b[2]:%06o\n",(int)p_b[0],(int)p_b[1],(int)p_b[2]);
-
-	sshort exp_a = p_a[0] & 0x7fff;
-	exp_a = exp_a - 16384; /* offset for ND100 exp */
-	ndmant_to_ld(((unsigned int)p_a[1]<<16 | p_a[2]), &k);
-	a = k * pow2l((int)exp_a);
-	a = (isneg_a) ? -a : a;
-	if (debug) fprintf(debugfile,"FSB: a:%Lf\n",a);
-
-	sshort exp_b = p_b[0] & 0x7fff;
-	exp_b = exp_b - 16384; /* offset for ND100 exp */
-	ndmant_to_ld(((unsigned int)p_b[1]<<16 | p_b[2]), &k);
-	b = k * pow2l((int)exp_b);
-	b = (isneg_b) ? -b : b;
-	if (debug) fprintf(debugfile,"FSB: b:%Lf\n",b);
-
-	r= a - b;
-	if (debug) fprintf(debugfile,"FSB: r:%Lf instr_counter=%d\n",r,(int)instr_counter);
-	mant = frexpl(r,&exp); /* normalise */
-	if (mant < 0) {/* negative number */
-		mant = -mant;
-		isneg_r = true;
-	}
-
-	res = ld_to_ndmant(mant);
-
-	if (debug) fprintf(debugfile,"FSB: res:%d\n",(int)res);
-	p_r[0] = (ushort) 16384 + exp;
-	p_r[0] |= (isneg_r) ? 1<<15 : 0;
-	p_r[1] = (res >> 16) & 0xffff;
-	p_r[2] = res & 0xffff;
-	if ((p_r[2] == 0) &&(p_r[1] == 0)) /* result is 0 */
-		p_r[0] = 0; /* set exp and sign -> 0 too */
-	if (debug) fprintf(debugfile,"FSB: p_r[0]:%06o p_r[1]:%06o p_r[2]:%06o\n",(int)p_r[0],(int)p_r[1],(int)p_r[2]);
-	if (debug) fprintf(debugfile,"FSB: mant:%Lf exp:%d\n",mant,exp);
-	if (debug) fprintf(debugfile,"FSB: ******************************\n");
-	return(0);
+	ushort neg_b[3];
+	neg_b[0] = p_b[0] ^ 0x8000;
+	neg_b[1] = p_b[1];
+	neg_b[2] = p_b[2];
+	return NDFloat_Add(p_a,neg_b,p_r);
 }
 
 /*
@@ -695,87 +545,49 @@ int NDFloat_Sub(ushort* p_a, ushort* p_b,ushort* p_r) {
  *	NOTE: D will be cleared as per manual.
  */
 void DoNLZ (char scaling) {
-	if (debug) fprintf(debugfile,"DoNLZ: A:%06o scaling:%d instr_counter=%d\n",gA,(int)scaling,(int)instr_counter);
+	bool isneg = (gA & 0x8000) ? true : false;
+	unsigned int val;
+	int lz;
 	if (gA==0) { /* special case, return with TAD=0 */
 		gT=0;
 		gA=0;
 		gD=0;
 		return;
 	}
-	bool isneg = (gA & 0x8000)>> 15;
-	int e,val;
-	long double mantissa,x;
-	int i,j;
-	long double k,l;
-	ushort res = 0;
-	e = (int)scaling - 16; /* adjust offset, +16 = 2^0 */
-	val = (int)(sshort)gA;
-	x=(long double)val * pow2l(e);
-	mantissa = frexpl(x,&e); /* normalise */
-	if (mantissa < 0) /* negative number, ignore since we got sign bit already */
-		mantissa = -mantissa;
-	if (debug) fprintf(debugfile,"DoNLZ: x:%Lf val(lf):%Lf val(int):%d\n",x,(long double)val,val);
-	if (debug) fprintf(debugfile,"DoNLZ: isneg:%d exp:%d mantissa:%08x\n",(int)isneg,e,(int)mantissa);
-	if (debug) fprintf(debugfile,"DoNLZ: long double mantissa:%Lf\n",mantissa);
-	j=15;
-	i=-1;
-	l=0; k=0;
-	for(i=-1; i>-16;i--) {
-		l=k+pow2l(i);
-		if (l>mantissa) { /* 0 in this bit pos */
-			res &= ~(1<<j);
-		} else { /* 1 in this bit pos */
-			res |= 1<<j;
-			k=l;
-		}
-		j--;
-	}
-	if (debug) fprintf(debugfile,"DoNLZ: res:%d\n",(int)res);
-	gT = (ushort) 16384 + e;
+	val = (isneg) ? -(int)(sshort)gA : gA; /* magnitude, 1 to 32768 */
+	lz = __builtin_clz(val);
+	gT = (ushort)(16384 + (int)scaling - 16 + 32 - lz);
 	gT |= (isneg) ? 1<<15 : 0;
-	gA = res;
+	gA = (val << lz) >> 16;
 	gD = 0;
-	if (debug) fprintf(debugfile,"DoNLZ: T:%06o A:%06o D:%06o\n",gT,gA,gD);
-	if (debug) fprintf(debugfile,"DoNLZ: ******************************\n");
+	if (debug) fprintf(debugfile,"DoNLZ: scaling:%d T:%06o A:%06o D:%06o\n",(int)scaling,gT,gA,gD);
 }
 
 /*
  *	Denormalize floating point number.
  *	Converts a floating point number in {T,A,D} to an integer in register A according to scaling factor.
  *	Input parameters: a scaling factor.
+ *	The result is truncated towards zero. Z is set if it does not fit in 16 bits.
  *	:NOTE: There are some remarks in the manual saying that there are some cases when
  *	this instruction gives erroneus results. Our implementation is much more precise than the original hardware.
  */
 void DoDNZ(char scaling) {
-	if (debug) fprintf(debugfile,"DoDNZ: T:%06o A:%06o D:%06o scaling:%d\n",gT,gA,gD,(int)scaling);
-	bool isneg = (gT & 0x8000)>> 15;
-	sshort exp = gT & 0x7fff;
-	exp = exp - 16384; /* offset for ND100 exp */
-	ulong mantissa = ((unsigned long)gA<<16) | gD;
-	if (debug) fprintf(debugfile,"DoDNZ: isneg:%d exp:%d mantissa:%08x\n",(int)isneg,(int)exp,(int)mantissa);
-	int j,k;
-	long double i,t;
-	k=31;
-	i=0;
-	for(j=-1; j>-32;j--) {
-		t=((mantissa>>k) &0x01)* pow2l(j);
-		i+=t;
-		k--;
+	bool isneg = (gT & 0x8000) ? true : false;
+	unsigned long long mantissa = ((unsigned int)gA<<16) | gD;
+	int shift = (int)(gT & 0x7fff) - 16384 + (int)scaling + 16 - 32; /* value = mantissa * 2**shift */
+	long long i;
+	bool overflow = false;
+	if (shift >= 0) {
+		overflow = (mantissa != 0) && (shift > 31);
+		i = (overflow) ? 0 : (long long)(mantissa << shift);
+	} else {
+		i = (shift <= -64) ? 0 : (long long)(mantissa >> -shift);
 	}
-	i= i* pow2l((int)exp);
 	i = (isneg) ? -i : i;
-	if (debug) fprintf(debugfile,"DoDNZ: long double i:%Lf\n",i);
-	/* ok we now have the ND float in long double format */
-	exp= scaling + 16;
-	if (debug) fprintf(debugfile,"DoDNZ: exp:%d\n",(int)exp);
-	i = i * pow2l((int)exp);
-	i = truncl(i);
-	gA= (sshort) i;
-	if (debug) fprintf(debugfile,"DoDNZ: gA:%06o\n",gA);
-	if (debug) fprintf(debugfile,"DoDNZ: ******************************\n");
-	j= (int) i;
-	if (abs(j) > 32767)	/* Overflow */
+	gA = (ushort)i;
+	if (overflow || (i > 32767) || (i < -32767))	/* Overflow */
 		setbit(_STS,_Z,1);
+	if (debug) fprintf(debugfile,"DoDNZ: scaling:%d A:%06o\n",(int)scaling,gA);
 	gT=0;
 	gD=0;
 }
@@ -24,6 +24,7 @@
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <pthread.h>
@@ -67,7 +68,10 @@ void io_op (ushort ioadd) {
  * Access to unpopulated IO area
  */
 void Default_IO(ushort ioadd) {
-	mysleep(0,10); /* Sleep 10us for IOX timeout time simulation */
+	if (RTC_VIRTUAL)
+		EventAdvance((double)RTC_IPT / 2000); /* IOX timeout takes 10us of device time */
+	else
+		mysleep(0,10); /* Sleep 10us for IOX timeout time simulation */
 	if(gReg->reg_IIE & 0x80) {
 		if (trace & 0x01) fprintf(tracefile,
 			"#o (i,d) #v# (\"%d\",\"No IO device, IOX error interrupt after 10 us.\");\n",
@@ -739,6 +743,9 @@ void console_stdio_in() {
 					if (debug) fprintf(debugfile,"ERROR!!! sem_post failure console_stdio_in\n");
 					CurrentCPURunMode = SHUTDOWN;
 				}
+			} else if ((numread == 0) && FORKSERVER) { /* fork server job hung up, end like on SIGTERM */
+				kill(getpid(), SIGTERM);
+				break;
 			}
 		}
 	}
@@ -754,7 +761,8 @@ void console_stdio_thread() {
 
 	if (debug) fprintf(debugfile,"(#)console_stdio_thread running...\n");
 	if (debug) fflush(debugfile);
-	tty_arr[0] = calloc(1,sizeof(struct tty_io_data));
+	if (!tty_arr[0]) /* a restored snapshot may have brought one */
+		tty_arr[0] = calloc(1,sizeof(struct tty_io_data));
 
 	tc_elem=AddThreadChain();
 	pthread_attr_init(&tc_elem->tattr);
@@ -899,7 +907,8 @@ void console_socket_thread() {
 
 	if (debug) fprintf(debugfile,"(#)console_socket_thread running...\n");
 	if (debug) fflush(debugfile);
-	tty_arr[0] = calloc(1,sizeof(struct tty_io_data));
+	if (!tty_arr[0]) /* a restored snapshot may have brought one */
+		tty_arr[0] = calloc(1,sizeof(struct tty_io_data));
 
 	do_listen(5001, 1, &sock);
 	if (debug) fprintf(debugfile,"\n(#)TCPServer Waiting for client on port 5001\n");
@@ -1020,10 +1029,13 @@ void panel_thread() {
 				if (debug) fprintf(debugfile,"(#)MCL_PRESSED\n");
 				/* TODO:: this should be in a separate routine DoMCL later */
 				CurrentCPURunMode = STOP;
+				CpuWake(); /* in case cpu is idle */
 				/* NOTE:: buggy in that we cannot do STOP and MCL without a running cpu between.. FIXME */
 				while ((s = sem_wait(&sem_stop)) == -1 && errno == EINTR) /* wait for stop lock to be free and take it */
 					continue; /* Restart if interrupted by handler */
 				bzero(gReg,sizeof(struct CpuRegs));	/* clear cpu */
+				HotStateSync();
+				TLB_Flush();
 				setbit(_STS,_O,1);
 				setbit_STS_MSB(_N100,1);
 				gCSR = 1<<2;    /* this bit sets the cache as not available */
@@ -1039,6 +1051,7 @@ void panel_thread() {
 			} else if(strncmp("STOP_PRESSED\n",recv_data,strlen("STOP_PRESSED"))==0){
 				if (debug) fprintf(debugfile,"(#)STOP_PRESSED\n");
 				CurrentCPURunMode = STOP;
+				CpuWake(); /* in case cpu is idle */
 				/* NOTE:: buggy in that we cannot do STOP and MCL without a running cpu between.. FIXME */
 				while ((s = sem_wait(&sem_stop)) == -1 && errno == EINTR) /* wait for stop lock to be free and take it */
 					continue; /* Restart if interrupted by handler */
@@ -1052,6 +1065,101 @@ void panel_thread() {
 	return;
 }
 
+/*
+ * Fork server jobs would all write the server's debug log, trace, statistics,
+ * snapshot and checkpoint files. Each job gets its own, named with its pid
+ * appended.
+ */
+static char *job_name(char *name) {
+	char *s = malloc(strlen(name) + 16);
+	if (!s)
+		return name;
+	sprintf(s,"%s.%d",name,(int)getpid());
+	return s;
+}
+
+static void job_files() {
+	if (debug) {
+		fclose(debugfile);
+		debugname = job_name(debugname);
+		debug_open();
+	}
+	if (trace && tracefile) {
+		fclose(tracefile);
+		if (trace2file) fclose(trace2file);
+		tracename = job_name(tracename);
+		trace2name = job_name(trace2name);
+		trace_open();
+	}
+	disasm_fname = job_name(disasm_fname);
+	pairstat_fname = job_name(pairstat_fname);
+	if (SNAPSHOT_FILE)
+		SNAPSHOT_FILE = job_name(SNAPSHOT_FILE);
+	if (CHECKPOINT_FILE)
+		CHECKPOINT_FILE = job_name(CHECKPOINT_FILE);
+	SnapshotInit(); /* count the checkpoint interval from the start of the job */
+}
+
+/*
+ * fork_server: Hand out clones of the loaded machine on a UNIX socket.
+ * Called after program_load and before any threads exist, so fork()
+ * copies a machine that is not running. For every connection a child
+ * returns from here with the connection as its console, and goes on to
+ * start its own threads. Guest memory is a private mapping, so all the
+ * children share it copy on write. The parent never returns.
+ */
+void fork_server() {
+	struct sockaddr_un addr;
+	sigset_t set;
+	int sock, conn;
+	pid_t pid;
+
+	sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, FORKSERVER, sizeof(addr.sun_path) - 1);
+	unlink(FORKSERVER); /* left over from an earlier run */
+	if ((sock < 0) || bind(sock, (struct sockaddr *)&addr, sizeof(addr)) || listen(sock, 16)) {
+		fprintf(stderr,"Unable to listen on %s: %s\n",FORKSERVER,strerror(errno));
+		exit(1);
+	}
+	if (debug) fprintf(debugfile,"Fork server listening on %s\n",FORKSERVER);
+	if (debug) fflush(debugfile);
+
+	signal(SIGCHLD, SIG_IGN); /* jobs are never waited for, so don't keep zombies */
+	sigemptyset(&set);
+	sigaddset(&set, SIGINT);
+	sigaddset(&set, SIGHUP);
+	sigaddset(&set, SIGTERM);
+	pthread_sigmask(SIG_UNBLOCK, &set, NULL); /* no signal thread here, let these kill us */
+
+	while (1) {
+		conn = accept(sock, NULL, NULL);
+		if (conn < 0)
+			continue;
+		pid = fork();
+		if (pid == 0) {
+			/* the job: console on the connection, then run as usual */
+			signal(SIGCHLD, SIG_DFL);
+			blocksignals();
+			close(sock);
+			dup2(conn, 0);
+			dup2(conn, 1);
+			close(conn);
+			rtc_resync(); /* we may have been parked here for a long time */
+			job_files();
+			if (debug) fprintf(debugfile,"Fork server job %d started\n",(int)getpid());
+			if (debug) fflush(debugfile);
+			return;
+		}
+		if ((pid < 0) && debug) {
+			fprintf(debugfile,"ERROR!!! fork server: fork failed: %s\n",strerror(errno));
+			fflush(debugfile); /* so the next job does not write it out again */
+		}
+		close(conn);
+	}
+}
+
 void setup_pap(){
 	gPANS=0x8000;	/* Tell system we are here */
 	gPANS=gPANS | 0x4000;	/* Set FULL which is active low, so not full */
@@ -24,12 +24,22 @@
 
 extern int trace;
 extern FILE *tracefile;
+extern FILE *trace2file;
+extern char *tracename;
+extern char *trace2name;
+extern char *disasm_fname;
+extern char *pairstat_fname;
 extern int debug;
 extern FILE *debugfile;
+extern char *debugname;
+extern char *SNAPSHOT_FILE;
+extern char *CHECKPOINT_FILE;
 
 extern struct CpuRegs *gReg;
+extern struct CpuHot gHot;
 extern _RUNMODE_ CurrentCPURunMode;
 extern int CONSOLE_IS_SOCKET;
+extern char *FORKSERVER;
 extern ushort MODE_OPCOM;
 
 extern ushort STARTADDR;
@@ -53,54 +63,8 @@ void (*ioarr[65536])(ushort);
 /* NOT USED YET */
 void (*iodata[65536]);
 
-struct tty_io_data {
-	ushort snd_arr[256];	/* send ringbuffer */
-	unsigned char snd_fp;	/* feeded pointer for snd ringbuffer */
-	unsigned char snd_cp;	/* consumer pointer for snd ringbuffer */
-	ushort rcv_arr[256];	/* rcv ringbuffer */
-	unsigned char rcv_fp;	/* feeded pointer for rcv ringbuffer */
-	unsigned char rcv_cp;	/* consumer pointer for rcv ringbuffer */
-	unsigned char ttynum;	/* which ttynum is this?? (0=console) */
-	ushort in_status;
-	ushort in_control;
-	ushort out_status;
-	ushort out_control;
-};
-
 struct tty_io_data (*tty_arr[256]); /* array of pointers to con_io_data structures we allocate */
 
-#define FDD_BUFSIZE 256
-struct fdd_unit {
-	char *filename;
-	bool readonly;
-	FILE *fp;		/* pointer to actual file. If non null points to an open file */
-	int drive_format;	/* 0 = ibm3740, 1 = ibm3600, 2 = ibm system 32-II */
-	int curr_track;		/* track "head" is on now */
-	int diff_track;			/* difference between current and desired track */
-	int dir_track;			/* direction 0=lower track no, 1= higher track no */
-};
-
-struct floppy_data {
-	bool irq_en;			/* allow device interrupts */
-	int unit_select;		/* actual fdd 0-2 */
-	ushort buff[FDD_BUFSIZE];	/* buffer for 1 sectors data. FIXME:: Check that this is like the real floppy controller do.*/
-	int bufptr;			/* buffer pointer */
-	bool bufptr_msb;		/* If we work with bytes, access to lsb or msb in buf... */
-	struct fdd_unit (*unit[3]);	/* fdd drive unit 0-2 pointers to private data */
-	int selected_drive;		/* selected fdd unit 0-2 = drive, -1=no drive*/
-	bool test_mode;
-	unsigned char test_byte;
-	bool timeout_en;
-	bool sense;			/* error occured, check status reg 2 for details */
-	bool drive_not_rdy;		/* Set if drive is selected and drive has open door/no diskette (no attached file)*/
-	bool write_protect;		/* set if trying to write to write protected diskette (file) */
-	bool missing;			/* sector missing / no am */
-	bool busy;			/* processing a command */
-	int command;			/* command to execute */
-	ushort sector;
-	bool sector_autoinc;
-};
-
 struct hdd_10mb_unit {
 	char *filename; /* hdd image name */
 	char access;	/* 'r' = readonly, 'w' = read/write */
@@ -141,6 +105,7 @@ void mopc_out(char ch);
 void Console_IO(ushort ioadd);
 void Setup_IO_Handlers (void);
 void do_listen(int port, int numconn, int * sock);
+void fork_server(void);
 void console_stdio_in(void);
 void console_stdio_thread(void);
 void console_socket_in(int *connected);
@@ -153,7 +118,18 @@ void panel_processor_thread();
 
 extern void RTC_IO(ushort ioadd);
 extern int mysleep(int sec, int usec);
+extern int RTC_VIRTUAL;
+extern unsigned int RTC_IPT;
+extern void EventAdvance(double delta);
 extern void setbit_STS_MSB(ushort stsbit, char val);
 extern void setbit(ushort regnum, ushort stsbit, char val);
 extern void interrupt(ushort lvl, ushort sub);
+extern void TLB_Flush(void);
+extern void HotStateSync(void);
+extern void CpuWake(void);
+extern void rtc_resync(void);
+extern void blocksignals(void);
+extern int debug_open(void);
+extern int trace_open(void);
+extern void SnapshotInit(void);
 
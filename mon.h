@@ -32,6 +32,7 @@ extern char *regn[];
 extern unsigned short bank;
 extern unsigned short MON_RUN;
 extern struct CpuRegs *gReg;
+extern struct CpuHot gHot;
 
 extern double instr_counter;
 
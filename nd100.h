@@ -119,11 +119,12 @@ typedef signed long int slong;
 /* NEW ORGANIZATION OF MEMORY AND REGISTERS!!    */
 /*************************************************/
 
-/* Lets use the full 16MWord space now (32MB ram in host)*/
+/* Largest memory we can address, 16MWord (32MB address space in host) */
 #define MEMPTSIZE 16384
 
 /* Volatile Memory
- * Fixed to MEMPTSIZE KWords for now.
+ * Address space for MEMPTSIZE KWords is reserved at startup, host pages are
+ * only committed when touched. ND_Memsize words of it are installed memory.
  */
 typedef union ndram {
 	unsigned char	c_Array[MEMPTSIZE*1024*2];
@@ -131,6 +132,11 @@ typedef union ndram {
 	ushort		n_Pages[MEMPTSIZE][1024];
 } _NDRAM_ ;
 
+/* Physical pages written since the last checkpoint, one bit per 1K word page */
+#define DIRTY_WORDS	(MEMPTSIZE/64)
+#define MemDirty(ppn)	(gDirty[(ppn)>>6] |= 1ULL<<((ppn) & 0x3f))
+extern unsigned long long gDirty[DIRTY_WORDS];
+
 /* Paging tables(Shadow memory) */
 typedef union ndpt {
 	ushort	word_array[4*64*2];
@@ -144,6 +150,31 @@ union NewPT {
 	ulong	pt[4][64];
 };
 
+/*
+ * Software TLB in front of the page tables.
+ * One set of 64 entries per runlevel and per PT/APT selection, each holding the host address
+ * of the translated physical page and which kinds of access have already been checked and
+ * had their PGU/WIP bits set. An entry is only trusted while the page table entry, the
+ * PCR of the level and the SEXI/PONI bits are unchanged, so those must flush it.
+ */
+#define TLB_READ	0x01
+#define TLB_WRITE	0x02
+#define TLB_FETCH	0x04
+
+struct TLBEntry {
+	ushort *page;		/* host address of the physical page */
+	unsigned char perm;	/* TLB_READ, TLB_WRITE, TLB_FETCH */
+};
+
+/*
+ * Memory accessors for one paging mode (POF, PON, PON+SEXI).
+ */
+struct MemOps {
+	ushort (*read)(ushort addr, bool UseAPT);
+	ushort (*fetch)(ushort addr, bool UseAPT);
+	void (*write)(ushort value, ushort addr, bool UseAPT, unsigned char byte_select);
+};
+
 struct CpuRegs {
 	ushort	reg[16][16];	/* main CPU registers for all runlevels */
 	ushort	reg_PANS;	/* */
@@ -196,6 +227,32 @@ struct CpuRegs {
 	ushort	breakpoint;
 };
 
+/*
+ * Hot cpu state, things every instruction needs that otherwise would have to be
+ * dug out of gReg->reg[0][_STS] each time. It is only a cache of gReg, so it
+ * must be refreshed with HotStateSync() whenever PIL or the STS MSB flags change.
+ * PTM and the other LSB flags belong to each level and are read through bank.
+ */
+struct CpuHot {
+	ushort	*bank;		/* register bank of current runlevel, gReg->reg[PIL] */
+	ushort	level;		/* current runlevel */
+	bool	ioni;		/* STS IONI */
+	bool	poni;		/* STS PONI */
+	bool	sexi;		/* STS SEXI */
+} __attribute__((aligned(64)));
+
+/*
+ * Lazy C and Q flags.
+ * do_add only records its operands and result here, and the flags are written
+ * into STS of the current level by LazyFlagSync() when something looks at STS,
+ * or before the level is changed. O is sticky and still set at once on overflow.
+ */
+struct LazyFlags {
+	bool	pending;	/* C and Q below not yet written to STS */
+	ushort	a, b;		/* operands, k is only needed in res */
+	int	res;		/* a + b + k */
+};
+
 /*
  * A structure to trace all memoryaccesses for an instruction to be able to debug better.
  * Works as a chained list, and should be built up during an instruction, and destroyed after.
@@ -222,31 +279,24 @@ struct ThreadChain {
 };
 
 /*
- * Structure for identifying interrupting device. To simplify the detection of which interrupting
- * device caused it, let us have a linked list of all pending interrupts in the system. A doubly linked
- * one so we can unchain an element in the middle quite easily as well as traverse it back and forth.
- * Use one list for now, but we can both split it into several as well as keep it. Also have a for now
- * unused variable called slotnum, which can be used later if we want to mimic ND100 ordering behaviour closer.
+ * Pending IDENT codes for levels 10-13. One bit per ident code (9 bits, so 512 codes),
+ * which gives a fixed size map per level and no allocation when a device interrupts.
+ * A device posting twice before being identified simply sets the same bit again.
  */
-struct IdentChain {
-	char level; /* interrupt level this is. Might not be needed, if we use one list per level */
-	ushort slotnum; /* which slot in the rack the device sits at. unused for now. */
-	ushort identcode; /* which interrupting device it is. */
-	int callerid;	/* We create this as a unique id, as there are identids that are same for several devices? */
-	struct IdentChain *prev, *next; /* the links */
-};
+#define IDENT_WORDS	8	/* 512 ident codes, 64 per word */
+#define IDENT_LEVEL(l)	((l)-10)	/* index into gIdent for levels 10-13 */
 
 typedef enum {SHUTDOWN, STOP, SEMIRUN, RUN} _RUNMODE_;
 
 typedef enum {ND1, ND4, ND10, ND100, ND100CE, ND100CX, ND110, ND110CE, ND110CX, ND110PCX} _CPUTYPE_;
 
-#define gPC	gReg->reg[((gReg->reg[0][_STS] & 0x0f00) >>8)][_P]
-#define gA	gReg->reg[((gReg->reg[0][_STS] & 0x0f00) >>8)][_A]
-#define gT	gReg->reg[((gReg->reg[0][_STS] & 0x0f00) >>8)][_T]
-#define gB	gReg->reg[((gReg->reg[0][_STS] & 0x0f00) >>8)][_B]
-#define gD	gReg->reg[((gReg->reg[0][_STS] & 0x0f00) >>8)][_D]
-#define gX	gReg->reg[((gReg->reg[0][_STS] & 0x0f00) >>8)][_X]
-#define gL	gReg->reg[((gReg->reg[0][_STS] & 0x0f00) >>8)][_L]
+#define gPC	gHot.bank[_P]
+#define gA	gHot.bank[_A]
+#define gT	gHot.bank[_T]
+#define gB	gHot.bank[_B]
+#define gD	gHot.bank[_D]
+#define gX	gHot.bank[_X]
+#define gL	gHot.bank[_L]
 
 #define gPANC	gReg->reg_PANC
 #define gPANS	gReg->reg_PANS
@@ -271,32 +321,35 @@ typedef enum {ND1, ND4, ND10, ND100, ND100CE, ND100CX, ND110, ND110CE, ND110CX,
 #define gECCR	gReg->reg_ECCR
 
 /* Use lvl0 as default to start with, and then just always(!!!) set all levels when setting STS MSB flags */
-/* so by default we use reg[0][_STS] as MSB STS */
-#define CurrLEVEL	((gReg->reg[0][_STS] & 0x0f00) >>8)
-#define gPIL		((gReg->reg[0][_STS] & 0x0f00) >>8)
+/* so by default we use reg[0][_STS] as MSB STS, cached in gHot */
+#define CurrLEVEL	gHot.level
+#define gPIL		gHot.level
 
 /* Highest runlevel with PIE AND PID bits both set */
 #define gPK		gReg->myreg_PK
 
+/* Tell the cpu thread PID/PIE changed and PK must be recomputed */
+#define SetIntPending()	__atomic_store_n(&gIntPending,true,__ATOMIC_RELEASE)
+
 /* The complete Status register both MSB and LSB for current runlevel. Read only MACRO */
 #define gSTSr		((gReg->reg[0][_STS] & 0xFF00) | (gReg->reg[(gReg->reg[][_STS] & 0x0f00) >>8][_STS] & 0x00FF))
 
 #define InstructionRegister	gReg->myreg_IR
 #define PrefetchBuffer		gReg->myreg_PFB
 
-#define STS_PTM  ((gReg->reg[((gReg->reg[0][_STS] & 0x0f00) >>8)][_STS] & 0x0001)>>0)	/* */
-#define STS_TG   ((gReg->reg[((gReg->reg[0][_STS] & 0x0f00) >>8)][_STS] & 0x0002)>>1)	/* */
-#define STS_K    ((gReg->reg[((gReg->reg[0][_STS] & 0x0f00) >>8)][_STS] & 0x0004)>>2)	/* */
-#define STS_Z    ((gReg->reg[((gReg->reg[0][_STS] & 0x0f00) >>8)][_STS] & 0x0008)>>3)	/* */
-#define STS_Q    ((gReg->reg[((gReg->reg[0][_STS] & 0x0f00) >>8)][_STS] & 0x0010)>>4)	/* */
-#define STS_O    ((gReg->reg[((gReg->reg[0][_STS] & 0x0f00) >>8)][_STS] & 0x0020)>>5)	/* */
-#define STS_C    ((gReg->reg[((gReg->reg[0][_STS] & 0x0f00) >>8)][_STS] & 0x0040)>>6)	/* */
-#define STS_M    ((gReg->reg[((gReg->reg[0][_STS] & 0x0f00) >>8)][_STS] & 0x0080)>>7)	/* */
+#define STS_PTM  ((gHot.bank[_STS] & 0x0001)>>0)						/* */
+#define STS_TG   ((gHot.bank[_STS] & 0x0002)>>1)						/* */
+#define STS_K    ((gHot.bank[_STS] & 0x0004)>>2)						/* */
+#define STS_Z    ((gHot.bank[_STS] & 0x0008)>>3)						/* */
+#define STS_Q    ((gHot.bank[_STS] & 0x0010)>>4)						/* */
+#define STS_O    ((gHot.bank[_STS] & 0x0020)>>5)						/* */
+#define STS_C    ((gHot.bank[_STS] & 0x0040)>>6)						/* */
+#define STS_M    ((gHot.bank[_STS] & 0x0080)>>7)						/* */
 #define STS_PL   ((gReg->reg[0][_STS] & 0x0f00) >>8)					/* Program runlevel */
 #define STS_N100 ((gReg->reg[0][_STS] & 0x1000) >>12)					/* Nord 100 indicator */
-#define STS_SEXI ((gReg->reg[0][_STS] & 0x2000) >>13)					/* Extended MMS adressing on/off indicator (24 bit instead of 19 bit*/
-#define STS_PONI ((gReg->reg[0][_STS] & 0x4000) >>14)					/* Memory management on/off indicator */
-#define STS_IONI ((gReg->reg[0][_STS] & 0x8000) >>15)					/* Interrupt system on/off indicator */
+#define STS_SEXI (gHot.sexi)										/* Extended MMS adressing on/off indicator (24 bit instead of 19 bit*/
+#define STS_PONI (gHot.poni)										/* Memory management on/off indicator */
+#define STS_IONI (gHot.ioni)										/* Interrupt system on/off indicator */
 
 #define UNDEF_INSTR ((ushort)0142500)
 
@@ -338,3 +391,56 @@ struct display_panel {
 	int function_mode;
 };
 
+struct rtc_data {
+        bool irq_en; /* enable irq when pulse occurs */
+        bool rdy; /* ready for transfer */
+	ushort cntr_20ms;	/* this should wrap at 50, so we count the num of 20ms interrupts to get second ticks */
+	bool tickless;	/* rtc_20 is not ticking, pulses are accounted when looked at */
+};
+
+struct tty_io_data {
+	ushort snd_arr[256];	/* send ringbuffer */
+	unsigned char snd_fp;	/* feeded pointer for snd ringbuffer */
+	unsigned char snd_cp;	/* consumer pointer for snd ringbuffer */
+	ushort rcv_arr[256];	/* rcv ringbuffer */
+	unsigned char rcv_fp;	/* feeded pointer for rcv ringbuffer */
+	unsigned char rcv_cp;	/* consumer pointer for rcv ringbuffer */
+	unsigned char ttynum;	/* which ttynum is this?? (0=console) */
+	ushort in_status;
+	ushort in_control;
+	ushort out_status;
+	ushort out_control;
+};
+
+#define FDD_BUFSIZE 256
+struct fdd_unit {
+	char *filename;
+	bool readonly;
+	FILE *fp;		/* pointer to actual file. If non null points to an open file */
+	int drive_format;	/* 0 = ibm3740, 1 = ibm3600, 2 = ibm system 32-II */
+	int curr_track;		/* track "head" is on now */
+	int diff_track;			/* difference between current and desired track */
+	int dir_track;			/* direction 0=lower track no, 1= higher track no */
+};
+
+struct floppy_data {
+	bool irq_en;			/* allow device interrupts */
+	int unit_select;		/* actual fdd 0-2 */
+	ushort buff[FDD_BUFSIZE];	/* buffer for 1 sectors data. FIXME:: Check that this is like the real floppy controller do.*/
+	int bufptr;			/* buffer pointer */
+	bool bufptr_msb;		/* If we work with bytes, access to lsb or msb in buf... */
+	struct fdd_unit (*unit[3]);	/* fdd drive unit 0-2 pointers to private data */
+	int selected_drive;		/* selected fdd unit 0-2 = drive, -1=no drive*/
+	bool test_mode;
+	unsigned char test_byte;
+	bool timeout_en;
+	bool sense;			/* error occured, check status reg 2 for details */
+	bool drive_not_rdy;		/* Set if drive is selected and drive has open door/no diskette (no attached file)*/
+	bool write_protect;		/* set if trying to write to write protected diskette (file) */
+	bool missing;			/* sector missing / no am */
+	bool busy;			/* processing a command */
+	int command;			/* command to execute */
+	ushort sector;
+	bool sector_autoinc;
+};
+
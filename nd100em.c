@@ -53,17 +53,16 @@ int main(int argc, char *argv[]) {
 	if (debug) debug_open();
 	if (trace) trace_open();
 	if (DISASM) disasm_init();
+	if (PAIRSTATS) pairstat_init();
 
-	if (sem_init(&sem_int, 0, 1) == -1)
-		exit(1);
 	if (sem_init(&sem_cons, 0, 0) == -1) /* console locked, so thread waits for output at start */
 		exit(1);
 	if (sem_init(&sem_sigthr, 0, 0) == -1) /* signal thread locked, so it doesn't finish prematurely */
 		exit(1);
-	if (sem_init(&sem_rtc_tick, 0, 1) == -1) /* start with no lock. */
-		exit(1);
 	if (sem_init(&sem_rtc, 0, 1) == -1) /* start with no lock. */
 		exit(1);
+	if (sem_init(&sem_rtc_arm, 0, 0) == -1) /* locked, posted when the rtc interrupt is enabled */
+		exit(1);
 	if (sem_init(&sem_io, 0, 1) == -1) /* start with no lock. */
 		exit(1);
 	if (sem_init(&sem_floppy, 0, 1) == -1) /* start with lock. */
@@ -72,15 +71,19 @@ int main(int argc, char *argv[]) {
 		exit(1);
 	if (sem_init(&sem_run, 0, 0) == -1) /* start with no lock. */
 		exit(1);
+	if (sem_init(&sem_idle, 0, 0) == -1) /* locked, posted by CpuWake */
+		exit(1);
 	if (PANEL_PROCESSOR)
 		if (sem_init(&sem_pap, 0, 1) == -1) /* start with no lock. */
 			exit(1);
 
 	setup_cpu();
-	program_load();
-
+	rtc_init();
 	if (PANEL_PROCESSOR)
 		setup_pap();
+	program_load();
+	if (FORKSERVER)
+		fork_server(); /* returns in each job, never in the server */
 
 	/* Direct input/output enabled */
 	setcbreak ();
@@ -103,6 +106,7 @@ int main(int argc, char *argv[]) {
 	printf("Current cpu cycle time is:%f microsecs\n",(totaltime/((float)instr_counter/1000000)));
 
 	disasm_dump();
+	if (PAIRSTATS) pairstat_dump();
 
 	return(0);
 }
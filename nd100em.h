@@ -23,20 +23,23 @@
 extern int trace;
 extern int debug;
 extern int DAEMON;
+extern char *FORKSERVER;
 extern int DISASM;
+extern int PAIRSTATS;
 extern ushort PANEL_PROCESSOR;
 
 extern double instr_counter;
 extern struct ThreadChain *gThreadChain;
 
-extern sem_t sem_int;
 extern sem_t sem_cons;
 extern sem_t sem_sigthr;
-extern sem_t sem_rtc_tick;
 extern sem_t sem_rtc;
+extern sem_t sem_rtc_arm;
+extern void rtc_init(void);
 extern sem_t sem_io;
 extern sem_t sem_mopc;
 extern sem_t sem_run;
+extern sem_t sem_idle;
 extern sem_t sem_floppy;
 extern sem_t sem_pap;
 
@@ -56,6 +59,7 @@ extern int nd100emconf(void);
 extern void shutdown(void);
 extern void setsignals(void);
 extern void daemonize(void);
+extern void fork_server(void);
 extern void start_threads(void);
 extern void stop_threads(void);
 extern void setup_cpu(void);
@@ -65,6 +69,8 @@ extern int trace_open();
 extern void disasm_addword(ushort addr, ushort myword);
 extern void disasm_init();
 extern void disasm_dump();
+extern void pairstat_init();
+extern void pairstat_dump();
 extern void setup_pap();
 
 
@@ -35,6 +35,7 @@
 #include <limits.h>
 #include <string.h>
 #include <math.h>
+#include <sys/mman.h>
 #include <libconfig.h>
 #include "nd100.h"
 #include "nd100lib.h"
@@ -90,7 +91,7 @@ int bpun_load() {
 	int count, b_num, c_num;
 	char loadtype[]="r";
 	ushort *addr;
-	addr = (ushort *)&VolatileMemory;
+	addr = (ushort *)VolatileMemory;
 
 	if (debug) fprintf(debugfile,"BPUN file load:\n");
 	counter=0;
@@ -189,7 +190,7 @@ int bp_load() {
 
 	if (debug) fprintf(debugfile,"BP file load:\n");
 	bin_file=fopen(bpun,loadtype);
-	fread(&VolatileMemory,2,65536,bin_file);
+	fread(VolatileMemory,2,65536,bin_file);
 	for(i=0;i<65536;i++){
 		if (DISASM){
 			eff_word = MemoryRead((ushort)i,0);
@@ -317,6 +318,10 @@ int nd100emconf(){
 				BootType=BPUN;
 			} else if(strcmp("floppy",tmpstr)==0){
 				BootType=FLOPPY;
+			} else if(strcmp("snapshot",tmpstr)==0){
+				BootType=SNAPSHOT;
+			} else if(strcmp("checkpoint",tmpstr)==0){
+				BootType=CHECKPOINT;
 			} else {
 				/* TODO:: Need a default value */
 			}
@@ -363,6 +368,90 @@ int nd100emconf(){
 	} else {
 		DISASM = 0;
 	}
+	setting = config_lookup(pCFG, "pairstats");
+	if (setting) {
+		PAIRSTATS = config_setting_get_int(setting);
+	} else {
+		PAIRSTATS = 0;
+	}
+	setting = config_lookup(pCFG, "idle");
+	if (setting) {
+		IDLE = config_setting_get_int(setting);
+	} else {
+		IDLE = 1;
+	}
+	setting = config_lookup(pCFG, "rtc");
+	if (setting) {
+		tmpstr = (char *)config_setting_get_string(setting);
+		if ((tmpstr) && (strcmp("virtual",tmpstr)==0))
+			RTC_VIRTUAL = 1;
+		else
+			RTC_VIRTUAL = 0;
+	} else {
+		RTC_VIRTUAL = 0;
+	}
+	setting = config_lookup(pCFG, "rtc_ipt");
+	if (setting) {
+		RTC_IPT = config_setting_get_int(setting);
+		if (RTC_IPT == 0)
+			RTC_IPT = 20000;
+	} else {
+		RTC_IPT = 20000;
+	}
+	setting = config_lookup(pCFG, "memsize");
+	if (setting) {
+		ND_Memsize = (ulong)config_setting_get_int(setting) << 10;	/* given in KWords */
+		if ((ND_Memsize == 0) || (ND_Memsize > MEMPTSIZE*1024))
+			ND_Memsize = MEMPTSIZE*1024;
+	} else {
+		ND_Memsize = MEMPTSIZE*1024;
+	}
+	setting = config_lookup(pCFG, "hugepages");
+	if (setting) {
+		HUGEPAGES = config_setting_get_int(setting);
+	} else {
+		HUGEPAGES = 0;
+	}
+	setting = config_lookup(pCFG, "snapshot");
+	if (setting) {
+		tmpstr = (char *)config_setting_get_string(setting);
+		if (tmpstr)
+			SNAPSHOT_FILE = strdup(tmpstr);
+	}
+	if (!SNAPSHOT_FILE)
+		SNAPSHOT_FILE = strdup("nd100em.snap");
+	setting = config_lookup(pCFG, "snapshot_at");
+	if (setting) {
+		SNAPSHOT_AT = config_setting_get_int(setting);
+	} else {
+		SNAPSHOT_AT = 0;
+	}
+	setting = config_lookup(pCFG, "checkpoint");
+	if (setting) {
+		tmpstr = (char *)config_setting_get_string(setting);
+		if (tmpstr)
+			CHECKPOINT_FILE = strdup(tmpstr);
+	}
+	if (!CHECKPOINT_FILE)
+		CHECKPOINT_FILE = strdup("nd100em.ckpt");
+	setting = config_lookup(pCFG, "checkpoint_interval");
+	if (setting) {
+		CHECKPOINT_INTERVAL = config_setting_get_int(setting);
+	} else {
+		CHECKPOINT_INTERVAL = 0;
+	}
+	setting = config_lookup(pCFG, "checkpoint_restore");
+	if (setting) {
+		CHECKPOINT_RESTORE = config_setting_get_int(setting);
+	} else {
+		CHECKPOINT_RESTORE = -1;
+	}
+	setting = config_lookup(pCFG, "forkserver");
+	if (setting) {
+		tmpstr = (char *)config_setting_get_string(setting);
+		if (tmpstr && *tmpstr)
+			FORKSERVER = strdup(tmpstr);
+	}
 	setting = config_lookup(pCFG, "panel");
 	if (setting) {
 		PANEL_PROCESSOR = config_setting_get_int(setting);
@@ -413,6 +502,7 @@ void shutdown(int signum){
 
 	/* This works for now. All threads should terminate if this variable is set */
 	CurrentCPURunMode = SHUTDOWN;
+	CpuWake(); /* in case cpu is idle */
 
 	if (sem_post(&sem_run) == -1) { /* release rum lock */
 		if (debug) fprintf(debugfile,"ERROR!!! sem_post failure shutdown\n");
@@ -430,10 +520,8 @@ void shutdown(int signum){
 	if (debug) fflush(debugfile);
 }
 
-void rtc_handler (int signum){
-	if (sem_post(&sem_rtc_tick) == -1) { /* release rtc tick  lock */
-		if (debug) fprintf(debugfile,"ERROR!!! sem_post failure rtc_handler\n");
-	}
+void snapshot_signal(int signum){
+	SnapshotRequest();
 }
 
 void blocksignals() {
@@ -449,10 +537,11 @@ void blocksignals() {
 		sigaddset (&new_set, SIGTTOU);
 		sigaddset (&new_set, SIGTTIN);
 	}
-	sigaddset (&new_set, SIGALRM); /* ignore timer for process.. this one we will install handler for later */
+	sigaddset (&new_set, SIGALRM); /* ignore timer for process */
 	sigaddset (&new_set, SIGINT); /* kill signal we will catch in handles */
 	sigaddset (&new_set, SIGHUP); /* see above */
 	sigaddset (&new_set, SIGTERM); /* see above */
+	sigaddset (&new_set, SIGUSR1); /* snapshot request */
 	pthread_sigmask (SIG_BLOCK, &new_set, &old_set);
 }
 
@@ -460,7 +549,7 @@ void setsignalhandlers() {
 	static sigset_t   new_set;
 	static sigset_t   old_set;
 	static struct sigaction act;
-	static struct sigaction act_alrm;
+	static struct sigaction snapact;
 
 	/* set up handler for SIGINT, SIGHUP, SIGTERM */
 	act.sa_handler = &shutdown;
@@ -468,20 +557,16 @@ void setsignalhandlers() {
 	sigaction (SIGINT, &act, NULL);
 	sigaction (SIGHUP, &act, NULL);
 	sigaction (SIGTERM, &act, NULL);
+	/* and SIGUSR1 to take a snapshot */
+	snapact.sa_handler = &snapshot_signal;
+	sigemptyset (&snapact.sa_mask);
+	sigaction (SIGUSR1, &snapact, NULL);
 	sigemptyset (&new_set);
 	sigemptyset (&old_set);
 	sigaddset (&new_set, SIGINT);
 	sigaddset (&new_set, SIGHUP);
 	sigaddset (&new_set, SIGTERM);
-	pthread_sigmask (SIG_UNBLOCK, &new_set, &old_set);
-
-	/* set up handler for SIGALARM */
-	act_alrm.sa_handler = &rtc_handler;
-	sigemptyset (&act_alrm.sa_mask);
-	sigaction (SIGALRM, &act_alrm, NULL);
-	sigemptyset (&new_set);
-	sigemptyset (&old_set);
-	sigaddset (&new_set, SIGALRM);
+	sigaddset (&new_set, SIGUSR1);
 	pthread_sigmask (SIG_UNBLOCK, &new_set, &old_set);
 	return;
 }
@@ -556,9 +641,11 @@ void start_threads(){
 	if (debug) fprintf(debugfile,"Added thread id: %d as mopc_thread\n",(int)thread_id);
 	if (debug) fflush(debugfile);
 
-	thread_id = add_thread(&rtc_20,0);
-	if (debug) fprintf(debugfile,"Added thread id: %d as rtc_20\n",(int)thread_id);
-	if (debug) fflush(debugfile);
+	if (!RTC_VIRTUAL) {
+		thread_id = add_thread(&rtc_20,0);
+		if (debug) fprintf(debugfile,"Added thread id: %d as rtc_20\n",(int)thread_id);
+		if (debug) fflush(debugfile);
+	}
 
 	thread_id = add_thread(&panel_thread,0);
 	if (debug) fprintf(debugfile,"Added thread id: %d as panel_thread\n",(int)thread_id);
@@ -608,11 +695,42 @@ void stop_threads(){
 	}
 }
 
+/*
+ * Reserve address space for the largest memory we can have, and let the
+ * host commit pages as the guest touches them. With hugepages we first
+ * try explicit huge pages, then ask for transparent ones.
+ */
+void setup_memory(){
+	size_t size = sizeof(_NDRAM_);
+	void *p = MAP_FAILED;
+	if (VolatileMemory)
+		return;
+#ifdef MAP_HUGETLB
+	if (HUGEPAGES)
+		p = mmap(NULL,size,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE|MAP_HUGETLB,-1,0);
+#endif
+	if (p == MAP_FAILED) {
+		p = mmap(NULL,size,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE,-1,0);
+		if (p == MAP_FAILED) {
+			fprintf(stderr,"Unable to map %lu bytes for guest memory\n",(unsigned long)size);
+			exit(1);
+		}
+#ifdef MADV_HUGEPAGE
+		if (HUGEPAGES)
+			madvise(p,size,MADV_HUGEPAGE);
+#endif
+	}
+	VolatileMemory = p;
+	if (debug) fprintf(debugfile,"Guest memory: %lu KWords installed\n",ND_Memsize>>10);
+}
+
 void setup_cpu(){
+	setup_memory();
 	/* initialize an empty register set */
 	gReg=calloc(1,sizeof(struct CpuRegs));
 	/* initialize an empty pagetable */
 	gPT=calloc(1,sizeof(union NewPT));
+	HotStateSync();
 	/* Initialize IO handler functions */
 	Setup_IO_Handlers();
 	/* initialize floppy drive data structures */
@@ -622,12 +740,11 @@ void setup_cpu(){
 	setbit_STS_MSB(_N100,1);
 	gCSR = 1<<2;	/* this bit sets the cache as not available */
 
-	/* Initialise Ident List  pointer to null */
-	gIdentChain = 0;
+	/* No pending idents */
+	memset(gIdent,0,sizeof(gIdent));
 
 	/* Set cpu as running for now. Probably should depend on settings */
 	CurrentCPURunMode = RUN;
-	instr_counter=0;
 
 }
 
@@ -642,8 +759,21 @@ void program_load(){
 		gPC = (CONFIG_OK) ? STARTADDR : 0;
 		break;
 	case FLOPPY:
-		sectorread(0,0,1,(ushort *)&VolatileMemory);
+		sectorread(0,0,1,(ushort *)VolatileMemory);
 		gPC = 0;
 		break;
+	case SNAPSHOT:
+		if (SnapshotLoad(SNAPSHOT_FILE)) {
+			fprintf(stderr,"Unable to restore snapshot %s\n",SNAPSHOT_FILE);
+			exit(1);
+		}
+		break;
+	case CHECKPOINT:
+		if (CheckpointLoad(CHECKPOINT_FILE,CHECKPOINT_RESTORE)) {
+			fprintf(stderr,"Unable to restore checkpoint %s\n",CHECKPOINT_FILE);
+			exit(1);
+		}
+		break;
 	}
+	SnapshotInit();
 }
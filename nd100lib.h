@@ -22,23 +22,30 @@
 
 extern int trace;
 extern int DISASM;
+extern int PAIRSTATS;
+extern int IDLE;
+extern int RTC_VIRTUAL;
+extern unsigned int RTC_IPT;
 extern ushort PANEL_PROCESSOR;
 
-char debugname[]="debug.log";
+char *debugname="debug.log";
 char debugtype[]="a";
 FILE *debugfile;
 int debug = 0;
 
 #define RUNNING_DIR     "/tmp"
 
-extern _NDRAM_		VolatileMemory;
+extern _NDRAM_		*VolatileMemory;
+extern ulong		ND_Memsize;
+extern int		HUGEPAGES;
 extern _RUNMODE_	CurrentCPURunMode;
 extern _CPUTYPE_	CurrentCPUType;
 
 extern struct CpuRegs *gReg;
+extern struct CpuHot gHot;
 extern union NewPT *gPT;
 extern struct MemTraceList *gMemTrace;
-extern struct IdentChain *gIdentChain;
+extern unsigned long long gIdent[4][IDENT_WORDS];
 
 extern double instr_counter;
 
@@ -52,7 +59,7 @@ struct ThreadChain *gThreadChain;
 int emulatemon = 1;
 
 int CONFIG_OK = 0;	/* This should be set to 1 when config file has been loaded OK */
-typedef enum {BP, BPUN, FLOPPY} _BOOT_TYPE_;
+typedef enum {BP, BPUN, FLOPPY, SNAPSHOT, CHECKPOINT} _BOOT_TYPE_;
 _BOOT_TYPE_	BootType; /* Variable holding the way we should boot up the emulator */
 ushort	STARTADDR;
 /* should we try and disassemble as we run? */
@@ -61,16 +68,22 @@ int DISASM = 0;
 int DAEMON = 0;
 /* is console on a socket, or just the local one? */
 int CONSOLE_IS_SOCKET=0;
+/* UNIX socket to serve clones of the machine on, NULL when not a fork server */
+char *FORKSERVER = NULL;
 
 struct config_t *pCFG;
 
 extern char *FDD_IMAGE_NAME;
 extern bool FDD_IMAGE_RO;
+extern char *SNAPSHOT_FILE;
+extern int SNAPSHOT_AT;
+extern char *CHECKPOINT_FILE;
+extern int CHECKPOINT_INTERVAL;
+extern int CHECKPOINT_RESTORE;
 
 
 /* semaphore to release signal thread when terminating */
 sem_t sem_sigthr;
-extern sem_t sem_rtc_tick;
 extern sem_t sem_mopc;
 extern sem_t sem_run;
 
@@ -86,6 +99,8 @@ extern void floppy_thread(void);
 extern void floppy_init(void);
 extern void MemoryWrite(ushort value, ushort addr, bool UseAPT, unsigned char byte_select);
 extern ushort MemoryRead(ushort addr, bool UseAPT);
+extern void HotStateSync(void);
+extern void CpuWake(void);
 
 extern void Setup_IO_Handlers ();
 extern void setbit(ushort regnum, ushort stsbit, char val);
@@ -93,6 +108,10 @@ extern void setbit_STS_MSB(ushort stsbit, char val);
 extern int sectorread (char cyl, char side, char sector, unsigned short *addr);
 extern void disasm_addword(ushort addr, ushort myword);
 extern void panel_processor_thread();
+extern int SnapshotLoad(char *filename);
+extern int CheckpointLoad(char *filename, int upto);
+extern void SnapshotRequest(void);
+extern void SnapshotInit(void);
 
 
 int octalstr_to_integer(char *str);
@@ -106,11 +125,13 @@ struct ThreadChain *AddThreadChain(void);
 void RemThreadChain(struct ThreadChain * elem);
 int nd100emconf(void);
 void shutdown(int signum);
+void snapshot_signal(int signum);
 void setsignals(void);
 void daemonize(void);
 pthread_t add_thread(void *funcpointer, bool is_jointype);
 void start_threads(void);
 void stop_threads(void);
+void setup_memory(void);
 void setup_cpu(void);
 void program_load(void);
 
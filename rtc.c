@@ -30,95 +30,209 @@
 #include <semaphore.h>
 #include <sys/time.h>
 #include <sys/resource.h>
+#include <time.h>
 #include "nd100.h"
 #include "rtc.h"
 
 /*
- * rtc_20: a thread that sets the interrupt flag on lvl13 every 20 ms.
- * This function runs as a continuous program basically.
- * Uses posix timers and signals.
+ * rtc_now: CLOCK_MONOTONIC in ns. Served from the vdso on Linux,
+ * so it is cheap enough for the IOX path.
  */
-void rtc_20(){
-	int s;
-	int rc;
-	struct itimerval times;
-	bool irq_en;
-	int our_rnd_id;
-	int cntr_20ms;
+long long rtc_now(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
 
-	if (debug) fprintf(debugfile,"(##)rtc_20 started...\n");
+/*
+ * rtc_vtick: virtual time rtc pulse, an event that queues the next one.
+ */
+void rtc_vtick(int arg){
+	EventAdd(RTC_IPT,&rtc_vtick,0);
+	rtc_tick();
+}
 
-	our_rnd_id=rand(); /* our unique identifier for not generating multiple idents on the same device, TODO: Check if needed*/
+/*
+ * rtc_resync: start real time pulses over from now, for a machine that
+ * has been sitting still, like a fork server job.
+ */
+void rtc_resync(){
+	gRtcDeadline = rtc_now() + RTC_PERIOD;
+}
 
+/*
+ * rtc_init: allocate the rtc state before any thread can touch it,
+ * and in virtual time mode queue the first pulse.
+ */
+void rtc_init(){
 	sys_rtc=calloc(1,sizeof(struct rtc_data));
+	gRtcDeadline = rtc_now() + RTC_PERIOD;
+	if (RTC_VIRTUAL)
+		EventAdd(RTC_IPT,&rtc_vtick,0);
+}
 
-	/*
-	 * set up interval timer, starting in 20ms,
-	 *	then every 20 ms.
-	 */
-	times.it_value.tv_sec = 0;
-	times.it_value.tv_usec = 20000;
-	times.it_interval.tv_sec = 0;
-	times.it_interval.tv_usec = 20000;
-	rc = setitimer (ITIMER_REAL, &times, NULL);
-	if (rc==-1) {
-		if (debug) fprintf(debugfile,"ERROR!!! setitimer failure rtc_20. errno=%d\n",errno);
+/*
+ * rtc_panel_second: tick the panel processor seconds counter.
+ */
+static void rtc_panel_second(){
+	if(PANEL_PROCESSOR) {	/* OK here we should "tick" the panel processor?? */
+// TODO: This should most likely be changed to use a separate posix timer and signal thread etc. SIGUSR1 maybe
+/*TODO: tick panel second counter, also check if this is the right way, since we can "reset" the rtc 20ms timer */
+		gPAP->sec_tick = true;
+		if (sem_post(&sem_pap) == -1) { /* 'kick' panel processor thread */
+			if (debug) fprintf(debugfile,"ERROR!!! sem_post failure rtc_tick\n");
+			CurrentCPURunMode = SHUTDOWN;
+		}
 	}
+}
 
-	while(CurrentCPURunMode != SHUTDOWN) {
-		while ((s = sem_wait(&sem_rtc)) == -1 && errno == EINTR) /* wait for rtc synch lock to be free */
-			continue;       /* Restart if interrupted by handler */
-		irq_en = sys_rtc->irq_en;
-		sys_rtc->rdy = 1;
+/*
+ * rtc_tick: one 20 ms clock pulse. Sets ready, counts the panel seconds
+ * and interrupts lvl13 if enabled. Called by rtc_20 in real time mode,
+ * and by the rtc_vtick event in virtual time mode.
+ */
+void rtc_tick(){
+	int s;
+	bool irq_en;
+	int cntr_20ms;
 
-		if (sys_rtc->cntr_20ms >= 49) {	/* Think this is right.. :) 20ms x 50 = 1 sec */
-			sys_rtc->cntr_20ms = 0;
+	while ((s = sem_wait(&sem_rtc)) == -1 && errno == EINTR) /* wait for rtc synch lock to be free */
+		continue;       /* Restart if interrupted by handler */
+	irq_en = sys_rtc->irq_en;
+	sys_rtc->rdy = 1;
 
-		} else
-			sys_rtc->cntr_20ms++;
-		cntr_20ms = sys_rtc->cntr_20ms;
+	if (sys_rtc->cntr_20ms >= 49) {	/* Think this is right.. :) 20ms x 50 = 1 sec */
+		sys_rtc->cntr_20ms = 0;
 
-		if (sem_post(&sem_rtc) == -1) { /* release interrupt lock */
-			if (debug) fprintf(debugfile,"ERROR!!! sem_post failure rtc_20\n");
-			CurrentCPURunMode = SHUTDOWN;
-		}
+	} else
+		sys_rtc->cntr_20ms++;
+	cntr_20ms = sys_rtc->cntr_20ms;
 
-		if(PANEL_PROCESSOR) {	/* OK here we should "tick" the panel processor?? */
-// TODO: This should most likely be changed to use a separate posix timer and signal thread etc. SIGUSR1 maybe
-/*TODO: tick panel second counter, also check if this is the right way, since we can "reset" the rtc 20ms timer */
-			if (cntr_20ms == 0){
-				gPAP->sec_tick = true;
-				if (sem_post(&sem_pap) == -1) { /* 'kick' panel processor thread */
-					if (debug) fprintf(debugfile,"ERROR!!! sem_post failure rtc_20\n");
-					CurrentCPURunMode = SHUTDOWN;
-				}
-			}
-		}
+	if (sem_post(&sem_rtc) == -1) { /* release interrupt lock */
+		if (debug) fprintf(debugfile,"ERROR!!! sem_post failure rtc_tick\n");
+		CurrentCPURunMode = SHUTDOWN;
+	}
 
-		if (irq_en) {
-			if(CurrentCPURunMode != STOP) {
-				while ((s = sem_wait(&sem_int)) == -1 && errno == EINTR) /* wait for interrupt lock to be free */
-					continue;       /* Restart if interrupted by handler */
-				gPID |= 0x2000; /* Bit 13 */
-				AddIdentChain(13,1,our_rnd_id); /* Add interrupt to ident chain, lvl13, ident code 1, and identify us */
-				if (sem_post(&sem_int) == -1) { /* release interrupt lock */
-					if (debug) fprintf(debugfile,"ERROR!!! sem_post failure DOMCL\n");
+	if (cntr_20ms == 0)
+		rtc_panel_second();
+
+	if (irq_en) {
+		if(CurrentCPURunMode != STOP) {
+			IdentPost(13,1); /* Post ident code 1 on lvl13 */
+			interrupt(13,0); /* Bit 13, after the ident is in place */
+		}
+//		if(!PANEL_PROCESSOR) /* No panel processor available, trigger mopc here */
+			if (MODE_OPCOM) {
+				if (sem_post(&sem_mopc) == -1) { /* release mopc lock */
+					if (debug) fprintf(debugfile,"ERROR!!! sem_post failure rtc_tick\n");
 					CurrentCPURunMode = SHUTDOWN;
 				}
-				checkPK();
 			}
-//			if(!PANEL_PROCESSOR) /* No panel processor available, trigger mopc here */
-				if (MODE_OPCOM) {
-					if (sem_post(&sem_mopc) == -1) { /* release mopc lock */
-						if (debug) fprintf(debugfile,"ERROR!!! sem_post failure rtc_20\n");
-						CurrentCPURunMode = SHUTDOWN;
-					}
-				}
 
+	}
+}
+
+/*
+ * rtc_lazy: account for the pulses that passed while rtc_20 was tickless.
+ * Call with sem_rtc held. Sets ready and moves the 20 ms counter like the
+ * missed pulses would have, and returns true if a second boundary passed.
+ */
+static bool rtc_lazy(long long now){
+	long long deadline, n;
+	bool wrapped;
+	deadline = __atomic_load_n(&gRtcDeadline,__ATOMIC_RELAXED);
+	if (now < deadline)
+		return false;
+	n = (now - deadline) / RTC_PERIOD + 1;
+	if (!__atomic_compare_exchange_n(&gRtcDeadline,&deadline,deadline + n * RTC_PERIOD,false,__ATOMIC_RELAXED,__ATOMIC_RELAXED))
+		return false;	/* IOX 011 just cleared the counter */
+	sys_rtc->rdy = 1;
+	wrapped = (sys_rtc->cntr_20ms + n >= 50);
+	sys_rtc->cntr_20ms = (sys_rtc->cntr_20ms + n) % 50;
+	return wrapped;
+}
+
+/*
+ * rtc_20: a thread that sets the interrupt flag on lvl13 every 20 ms.
+ * This function runs as a continuous program basically.
+ * Sleeps to absolute deadlines on the monotonic clock, so the period does
+ * not drift with scheduling delays. If the host kept us from running, the
+ * missed pulses (up to a second worth) are given 1 ms apart to catch up.
+ * IOX 011 moves gRtcDeadline, which we notice when we wake up.
+ * While the rtc interrupt is off or the cpu is stopped nobody needs the
+ * pulses, so the thread goes tickless: it waits for IOX 013 to enable the
+ * interrupt (or a second, for the panel clock and a restarted cpu), and
+ * the missed pulses are accounted by rtc_lazy.
+ * Not used in virtual time mode.
+ */
+void rtc_20(){
+	long long mine, deadline, now, missed;
+	struct timespec ts;
+	int behind = 0;
+	int s;
+	bool wrapped;
+
+	if (debug) fprintf(debugfile,"(##)rtc_20 started...\n");
+
+	mine = __atomic_load_n(&gRtcDeadline,__ATOMIC_RELAXED);	/* the deadline we expect, anything else means IOX 011 */
+	while(CurrentCPURunMode != SHUTDOWN) {
+		while ((s = sem_wait(&sem_rtc)) == -1 && errno == EINTR) /* wait for rtc synch lock to be free */
+			continue;       /* Restart if interrupted by handler */
+		sys_rtc->tickless = (!sys_rtc->irq_en || (CurrentCPURunMode == STOP));
+		sem_post(&sem_rtc);
+		if (sys_rtc->tickless) {
+			if (PANEL_PROCESSOR || (CurrentCPURunMode == STOP)) {
+				clock_gettime(CLOCK_REALTIME,&ts);	/* sem_timedwait wants realtime */
+				ts.tv_sec++;
+				while ((s = sem_timedwait(&sem_rtc_arm,&ts)) == -1 && errno == EINTR) /* wait for IOX 013 or a second */
+					continue;
+			} else {
+				while ((s = sem_wait(&sem_rtc_arm)) == -1 && errno == EINTR) /* wait for IOX 013 */
+					continue;
+			}
+			while ((s = sem_wait(&sem_rtc)) == -1 && errno == EINTR) /* wait for rtc synch lock to be free */
+				continue;       /* Restart if interrupted by handler */
+			wrapped = rtc_lazy(rtc_now());
+			sys_rtc->tickless = false;
+			sem_post(&sem_rtc);
+			if (wrapped)
+				rtc_panel_second();
+			mine = __atomic_load_n(&gRtcDeadline,__ATOMIC_RELAXED);
+			behind = 0;
+			continue;
 		}
-		/* now wait for the alarms */
-		while ((s = sem_wait(&sem_rtc_tick)) == -1 && errno == EINTR) /* wait for rtc tick lock to be free */
+		deadline = (behind) ? rtc_now() + RTC_CATCHUP : mine;
+		ts.tv_sec = deadline / 1000000000LL;
+		ts.tv_nsec = deadline % 1000000000LL;
+		while (clock_nanosleep(CLOCK_MONOTONIC,TIMER_ABSTIME,&ts,NULL) == EINTR)
 			continue;       /* Restart if interrupted by handler */
+		deadline = __atomic_load_n(&gRtcDeadline,__ATOMIC_RELAXED);
+		if (deadline != mine) { /* rtc counter was cleared, start over from the new deadline */
+			mine = deadline;
+			behind = 0;
+			continue;
+		}
+		now = rtc_now();
+		if (now >= mine) {
+			/* Advance by whole periods, unless IOX 011 moves the deadline meanwhile */
+			missed = (now - mine) / RTC_PERIOD;
+			if (!__atomic_compare_exchange_n(&gRtcDeadline,&deadline,mine + RTC_PERIOD * (missed + 1),false,__ATOMIC_RELAXED,__ATOMIC_RELAXED)) {
+				mine = deadline;
+				behind = 0;
+				continue;
+			}
+			mine += RTC_PERIOD * (missed + 1);
+			behind += (int)missed;
+			if (behind > RTC_MAXBEHIND) {
+				if (debug) fprintf(debugfile,"rtc_20: %d ticks behind, dropping them\n",behind - RTC_MAXBEHIND);
+				behind = RTC_MAXBEHIND;
+			}
+		} else if (behind) {
+			behind--;	/* a catch up tick */
+		} else {
+			continue;	/* woke up early */
+		}
+		rtc_tick();
 	}
 }
 
@@ -127,28 +241,19 @@ void rtc_20(){
  */
 void RTC_IO(ushort ioadd) {
 	int s;
-	int rc;
-	struct itimerval times;
 	switch(ioadd) {
 	case 010: /* Return 0 in A, no other effect */
 		gA=0;
 		break;
 	case 011: /* Clear rtc counter. This resets rtc so next interrupt happens exactly 20ms later.*/
 		/* If done repeatedly, no rtc clock pulses will occur. */
-
-		/*
-		 * do it by setting up the timer again from scratch...
-		 * set up interval timer, starting in 20ms,
-		 *	then every 20 ms.
-		 */
-		times.it_value.tv_sec = 0;
-		times.it_value.tv_usec = 20000;
-		times.it_interval.tv_sec = 0;
-		times.it_interval.tv_usec = 20000;
-		rc = setitimer (ITIMER_REAL, &times, NULL);
-		if (rc==-1) {
-			if (debug) fprintf(debugfile,"ERROR!!! setitimer failure RTC_IO. errno=%d\n",errno);
+		if (RTC_VIRTUAL) {
+			EventCancel(&rtc_vtick,0);
+			EventAdd(RTC_IPT,&rtc_vtick,0);
+			break;
 		}
+		/* Just move the deadline, rtc_20 sees it when it wakes up */
+		__atomic_store_n(&gRtcDeadline,rtc_now() + RTC_PERIOD,__ATOMIC_RELAXED);
 		break;
 	case 012: /* Read real time clock status. */
 		/* Bit 0 = 1 => interrupt when next clock pulse arrives */
@@ -158,6 +263,8 @@ void RTC_IO(ushort ioadd) {
 		while ((s = sem_wait(&sem_rtc)) == -1 && errno == EINTR) /* wait for rtc synch lock to be free */
 			continue;       /* Restart if interrupted by handler */
 		if (sys_rtc) { /* make sure clock structure exist */
+			if (sys_rtc->tickless)
+				rtc_lazy(rtc_now());
 			gA |= (sys_rtc->irq_en) ? 1 : 0;
 			gA |= (sys_rtc->rdy) ?  1<<3 : 0;
 		}
@@ -172,8 +279,12 @@ void RTC_IO(ushort ioadd) {
 		while ((s = sem_wait(&sem_rtc)) == -1 && errno == EINTR) /* wait for rtc synch lock to be free */
 			continue;       /* Restart if interrupted by handler */
 		if (sys_rtc) { /* make sure clock structure exist */
+			if (sys_rtc->tickless)
+				rtc_lazy(rtc_now());
 			sys_rtc->irq_en = (gA & 0x01) ? 1 : 0 ;
 			if ((gA >> 13 )& 0x01) sys_rtc->rdy = 0;
+			if (sys_rtc->irq_en && sys_rtc->tickless)
+				sem_post(&sem_rtc_arm); /* get rtc_20 ticking again */
 		}
 		if (sem_post(&sem_rtc) == -1) { /* release interrupt lock */
 			if (debug) fprintf(debugfile,"ERROR!!! sem_post failure RTC_IO\n");
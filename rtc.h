@@ -20,31 +20,42 @@
  * distribution in the file COPYING); if not, see <http://www.gnu.org/licenses/>.
  */
 
-sem_t sem_rtc_tick;
 sem_t sem_rtc;
+sem_t sem_rtc_arm;
 
-struct rtc_data {
-        bool irq_en; /* enable irq when pulse occurs */
-        bool rdy; /* ready for transfer */
-	ushort cntr_20ms;	/* this should wrap at 50, so we count the num of 20ms interrupts to get second ticks */
-};
+#define RTC_PERIOD	20000000LL	/* 20 ms in ns */
+#define RTC_CATCHUP	1000000LL	/* 1 ms between catch up ticks */
+#define RTC_MAXBEHIND	50		/* most ticks we try to catch up, 1 second */
+
+long long gRtcDeadline;	/* CLOCK_MONOTONIC ns of the next real time rtc pulse */
 
 struct rtc_data *sys_rtc = NULL;
 
-extern sem_t sem_int;
+/* Virtual time: tick the rtc every RTC_IPT instructions from the cpu loop */
+int RTC_VIRTUAL = 0;
+unsigned int RTC_IPT = 20000;
+
 extern sem_t sem_mopc;
 extern sem_t sem_pap;
 extern struct display_panel *gPAP;
 
 extern struct CpuRegs *gReg;
+extern struct CpuHot gHot;
 extern ushort MODE_OPCOM;
 extern ushort PANEL_PROCESSOR;
 extern _RUNMODE_      CurrentCPURunMode;
 extern int debug;
 extern FILE *debugfile;
 
+long long rtc_now(void);
+void rtc_init(void);
+void rtc_resync(void);
+void rtc_tick(void);
+void rtc_vtick(int arg);
 void rtc_20(void);
 void RTC_IO(ushort ioadd);
 
-extern void AddIdentChain(char lvl, ushort identnum, int callerid);
-extern void checkPK();
+extern void IdentPost(char lvl, ushort identnum);
+extern void interrupt(ushort lvl, ushort sub);
+extern void EventAdd(double delay, void (*func)(int), int arg);
+extern void EventCancel(void (*func)(int), int arg);
@@ -0,0 +1,610 @@
+/*
+ * nd100em - ND100 Virtual Machine
+ *
+ * Copyright (c) 2006-20011 Roger Abrahamsson
+ *
+ * This file is originated from the nd100em project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (in the main directory of the nd100em
+ * distribution in the file COPYING); if not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include "nd100.h"
+#include "snapshot.h"
+
+/*
+ * Machine snapshots, so a booted system can be saved once and started
+ * again from there instead of booting every time.
+ * A snapshot is taken by the cpu thread between two instructions, asked
+ * for with SnapshotRequest (SIGUSR1 and the mopc SNAP command) or at a
+ * fixed instruction count from the config. It is restored by program_load
+ * with boot = "snapshot", before any threads are started.
+ *
+ * Checkpoints are the incremental version: every checkpoint_interval
+ * seconds a record with the same state sections and only the pages written
+ * since the record before (gDirty) is appended to the checkpoint file.
+ * boot = "checkpoint" replays the records up to a chosen one.
+ */
+
+static void snap_event(int arg);
+static void ckpt_event(int arg);
+
+/*
+ * Handlers that can be pending as events. A saved event names its handler
+ * by index in here, as the address can change between runs.
+ */
+static void (*snap_events[])(int) = {&rtc_vtick, &snap_event, &ckpt_event};
+#define SNAP_EVENTS	((int)(sizeof(snap_events)/sizeof(snap_events[0])))
+
+static ulong snap_roundup(ulong len) {
+	return (len + SNAP_ALIGN - 1) & ~((ulong)SNAP_ALIGN - 1);
+}
+
+static int snap_write(int fd, unsigned int id, void *data, unsigned int len) {
+	struct snap_section sec;
+	sec.id = id;
+	sec.len = len;
+	if (write(fd,&sec,sizeof(sec)) != (ssize_t)sizeof(sec))
+		return -1;
+	if (len && (write(fd,data,len) != (ssize_t)len))
+		return -1;
+	return 0;
+}
+
+static int snap_read(int fd, void *data, unsigned int len) {
+	return (read(fd,data,len) == (ssize_t)len) ? 0 : -1;
+}
+
+/*
+ * snap_write_mem: Write the installed memory at offset, padded to SNAP_ALIGN.
+ * Blocks that are all zero are left as holes, so the file takes about
+ * as much disk as the guest has used of its memory.
+ */
+static int snap_write_mem(int fd, ulong offset) {
+	static const unsigned char zero[4096];
+	unsigned char *mem = (unsigned char *)VolatileMemory;
+	ulong len = ND_Memsize * sizeof(ushort);
+	ulong i, n, start = 0;
+	bool inrun = false;
+
+	for (i = 0; i <= len; i += n) {
+		n = (len - i < sizeof(zero)) ? len - i : sizeof(zero);
+		if ((i < len) && memcmp(mem + i, zero, n)) {
+			if (!inrun)
+				start = i;
+			inrun = true;
+			continue;
+		}
+		if (inrun && (pwrite(fd,mem + start,i - start,offset + start) != (ssize_t)(i - start)))
+			return -1;
+		inrun = false;
+		if (i == len)
+			break;
+	}
+	return ftruncate(fd,offset + snap_roundup(len));
+}
+
+/*
+ * snap_write_state: Write the cpu and device state sections, up to and with SNAP_END.
+ */
+static int snap_write_state(int fd) {
+	struct snap_event sev;
+	struct floppy_data fdc;
+	struct fdd_unit fdd[3];
+	struct floppy_data *fp = iodata[880];
+	void (*func)(int);
+	double when;
+	int i, j, arg;
+	int res = 0;
+
+	res |= snap_write(fd,SNAP_REGS,gReg,sizeof(struct CpuRegs));
+	res |= snap_write(fd,SNAP_PT,gPT,sizeof(union NewPT));
+	res |= snap_write(fd,SNAP_IDENT,gIdent,sizeof(gIdent));
+	if (sys_rtc)
+		res |= snap_write(fd,SNAP_RTC,sys_rtc,sizeof(struct rtc_data));
+	if (gPAP)
+		res |= snap_write(fd,SNAP_PAP,gPAP,sizeof(struct display_panel));
+	if (tty_arr[0])
+		res |= snap_write(fd,SNAP_TTY,tty_arr[0],sizeof(struct tty_io_data));
+	if (fp) {
+		/* The drives and their image files come from the config, only the position is saved */
+		fdc = *fp;
+		memset(fdc.unit,0,sizeof(fdc.unit));
+		res |= snap_write(fd,SNAP_FLOPPY,&fdc,sizeof(fdc));
+		memset(fdd,0,sizeof(fdd));
+		for (i = 0; i < 3; i++) {
+			if (fp->unit[i]) {
+				fdd[i] = *fp->unit[i];
+				fdd[i].filename = NULL;
+				fdd[i].fp = NULL;
+			}
+		}
+		res |= snap_write(fd,SNAP_FDD,fdd,sizeof(fdd));
+	}
+	for (i = 0; EventPeek(i,&when,&func,&arg); i++) {
+		for (j = 0; (j < SNAP_EVENTS) && (snap_events[j] != func); j++)
+			;
+		if (j == SNAP_EVENTS) {
+			if (debug) fprintf(debugfile,"ERROR!!! snapshot: unknown event handler, event not saved\n");
+			continue;
+		}
+		sev.when = when;
+		sev.func = j;
+		sev.arg = arg;
+		res |= snap_write(fd,SNAP_EVENT,&sev,sizeof(sev));
+	}
+	res |= snap_write(fd,SNAP_END,NULL,0);
+	return res;
+}
+
+/*
+ * snap_read_state: Read state sections up to SNAP_END into the machine.
+ * Sections have to be the size of our structs, unknown ones are skipped.
+ * instr_counter must already be restored, events are relative to it.
+ */
+static int snap_read_state(int fd) {
+	struct snap_section sec;
+	struct snap_event sev;
+	struct floppy_data fdc;
+	struct fdd_unit fdd[3];
+	struct floppy_data *fp = iodata[880];
+	bool vtick = false;
+	int i;
+
+	EventClear();
+	while (!snap_read(fd,&sec,sizeof(sec)) && (sec.id != SNAP_END)) {
+		switch (sec.id) {
+		case SNAP_REGS:
+			if ((sec.len != sizeof(struct CpuRegs)) || snap_read(fd,gReg,sec.len))
+				return -1;
+			break;
+		case SNAP_PT:
+			if ((sec.len != sizeof(union NewPT)) || snap_read(fd,gPT,sec.len))
+				return -1;
+			break;
+		case SNAP_IDENT:
+			if ((sec.len != sizeof(gIdent)) || snap_read(fd,gIdent,sec.len))
+				return -1;
+			break;
+		case SNAP_RTC:
+			if ((sec.len != sizeof(struct rtc_data)) || snap_read(fd,sys_rtc,sec.len))
+				return -1;
+			sys_rtc->tickless = false;	/* rtc_20 is not running yet */
+			break;
+		case SNAP_PAP:
+			if (!gPAP)	/* no panel configured now */
+				goto skip;
+			if ((sec.len != sizeof(struct display_panel)) || snap_read(fd,gPAP,sec.len))
+				return -1;
+			break;
+		case SNAP_TTY:
+			if (!tty_arr[0])
+				tty_arr[0] = calloc(1,sizeof(struct tty_io_data));
+			if ((sec.len != sizeof(struct tty_io_data)) || snap_read(fd,tty_arr[0],sec.len))
+				return -1;
+			break;
+		case SNAP_FLOPPY:
+			if (!fp)
+				goto skip;
+			if ((sec.len != sizeof(fdc)) || snap_read(fd,&fdc,sec.len))
+				return -1;
+			memcpy(fdc.unit,fp->unit,sizeof(fdc.unit));
+			*fp = fdc;
+			break;
+		case SNAP_FDD:
+			if (!fp)
+				goto skip;
+			if ((sec.len != sizeof(fdd)) || snap_read(fd,fdd,sec.len))
+				return -1;
+			for (i = 0; i < 3; i++) {
+				if (!fp->unit[i])
+					continue;
+				fp->unit[i]->drive_format = fdd[i].drive_format;
+				fp->unit[i]->curr_track = fdd[i].curr_track;
+				fp->unit[i]->diff_track = fdd[i].diff_track;
+				fp->unit[i]->dir_track = fdd[i].dir_track;
+			}
+			break;
+		case SNAP_EVENT:
+			if ((sec.len != sizeof(sev)) || snap_read(fd,&sev,sec.len) || (sev.func < 0) || (sev.func >= SNAP_EVENTS))
+				return -1;
+			if (snap_events[sev.func] == &rtc_vtick) {
+				if (!RTC_VIRTUAL)	/* saved in virtual time, now real time */
+					break;
+				vtick = true;
+			}
+			EventAdd(sev.when - instr_counter,snap_events[sev.func],sev.arg);
+			break;
+		default:
+		skip:
+			if (lseek(fd,sec.len,SEEK_CUR) < 0)
+				return -1;
+			break;
+		}
+	}
+	if (sec.id != SNAP_END)
+		return -1;
+	if (RTC_VIRTUAL && !vtick)	/* saved in real time, now virtual time */
+		EventAdd(RTC_IPT,&rtc_vtick,0);
+	return 0;
+}
+
+/*
+ * snap_restored: Drop what was cached from before a restore.
+ */
+static void snap_restored(void) {
+	TLB_Flush();
+	HotStateSync();
+	__atomic_store_n(&gIntPending,true,__ATOMIC_RELEASE);	/* have the cpu look at PID/PIE */
+}
+
+/*
+ * SnapshotSave - Write the machine state to filename.
+ * Goes through a temporary file named after our pid and a rename, so an
+ * old snapshot that the memory is still mapped from is never written to.
+ * Only call from the cpu thread between instructions, or while it is stopped.
+ */
+int SnapshotSave(char *filename) {
+	struct snap_header hdr;
+	char *tmpname;
+	int fd;
+	int res = 0;
+
+	tmpname = malloc(strlen(filename) + 16);
+	if (!tmpname)
+		return -1;
+	sprintf(tmpname,"%s.%d.tmp",filename,(int)getpid()); /* no clash with another emulator saving the same file */
+	fd = open(tmpname,O_WRONLY | O_CREAT | O_TRUNC,0644);
+	if (fd < 0) {
+		if (debug) fprintf(debugfile,"ERROR!!! snapshot: cannot create %s: %s\n",tmpname,strerror(errno));
+		free(tmpname);
+		return -1;
+	}
+
+	memset(&hdr,0,sizeof(hdr));
+	memcpy(hdr.magic,SNAP_MAGIC,sizeof(hdr.magic));
+	hdr.version = SNAP_VERSION;
+	hdr.cputype = CurrentCPUType;
+	hdr.memsize = ND_Memsize;
+	hdr.instr_counter = instr_counter;
+	if (write(fd,&hdr,sizeof(hdr)) != (ssize_t)sizeof(hdr))
+		res = -1;
+	res |= snap_write_state(fd);
+
+	hdr.memoffset = snap_roundup(lseek(fd,0,SEEK_CUR));
+	res |= snap_write_mem(fd,hdr.memoffset);
+	if (pwrite(fd,&hdr,sizeof(hdr),0) != (ssize_t)sizeof(hdr))
+		res = -1;
+	if (close(fd))
+		res = -1;
+	if (!res && rename(tmpname,filename))
+		res = -1;
+	if (res) {
+		if (debug) fprintf(debugfile,"ERROR!!! snapshot: writing %s failed: %s\n",filename,strerror(errno));
+		unlink(tmpname);
+	} else {
+		if (debug) fprintf(debugfile,"snapshot: saved %s at instruction %.0f\n",filename,instr_counter);
+	}
+	if (debug) fflush(debugfile);
+	free(tmpname);
+	return res;
+}
+
+/*
+ * SnapshotLoad - Restore the machine state from filename.
+ * Called from program_load after setup_cpu and rtc_init, before the
+ * threads run. The memory image is mapped privately from the file, so
+ * restoring takes no copying and guest writes never reach the file.
+ * On failure the machine is left half restored, so the caller should give up.
+ */
+int SnapshotLoad(char *filename) {
+	struct snap_header hdr;
+	ulong len;
+	int fd;
+
+	fd = open(filename,O_RDONLY);
+	if (fd < 0) {
+		if (debug) fprintf(debugfile,"ERROR!!! snapshot: cannot open %s: %s\n",filename,strerror(errno));
+		return -1;
+	}
+	if (snap_read(fd,&hdr,sizeof(hdr)) || memcmp(hdr.magic,SNAP_MAGIC,sizeof(hdr.magic)) ||
+	    (hdr.version != SNAP_VERSION) || (hdr.memsize > MEMPTSIZE*1024) || (hdr.memoffset % SNAP_ALIGN)) {
+		if (debug) fprintf(debugfile,"ERROR!!! snapshot: %s is not a version %d snapshot\n",filename,SNAP_VERSION);
+		close(fd);
+		return -1;
+	}
+
+	CurrentCPUType = hdr.cputype;
+	ND_Memsize = hdr.memsize;
+	instr_counter = hdr.instr_counter;
+	if (snap_read_state(fd))
+		goto fail;
+
+	len = snap_roundup(ND_Memsize * sizeof(ushort));
+	if (mmap(VolatileMemory,len,PROT_READ | PROT_WRITE,MAP_PRIVATE | MAP_FIXED,fd,hdr.memoffset) == MAP_FAILED) {
+		/* explicit huge pages can not be replaced by a file mapping, so read it in */
+		if (debug) fprintf(debugfile,"snapshot: cannot map memory image (%s), reading it\n",strerror(errno));
+		if (pread(fd,VolatileMemory,ND_Memsize * sizeof(ushort),hdr.memoffset) != (ssize_t)(ND_Memsize * sizeof(ushort)))
+			goto fail;
+	}
+	close(fd);
+	snap_restored();
+
+	if (debug) fprintf(debugfile,"snapshot: restored %s at instruction %.0f, %lu KWords\n",filename,instr_counter,ND_Memsize>>10);
+	if (debug) fflush(debugfile);
+	return 0;
+
+fail:
+	if (debug) fprintf(debugfile,"ERROR!!! snapshot: %s is damaged or from another build\n",filename);
+	if (debug) fflush(debugfile);
+	close(fd);
+	return -1;
+}
+
+/*
+ * SnapshotRequest - Ask the cpu thread for a snapshot at the next instruction.
+ * Only uses atomics and sem_post, so it is safe from a signal handler.
+ */
+void SnapshotRequest(void) {
+	__atomic_store_n(&gSnapReq,true,__ATOMIC_RELEASE);
+	__atomic_store_n(&gIntPending,true,__ATOMIC_RELEASE);
+	CpuWake();	/* in case the cpu is idle */
+}
+
+/*
+ * SnapshotTake - Take an asked for snapshot, called from the cpu loop.
+ */
+void SnapshotTake(void) {
+	__atomic_store_n(&gSnapReq,false,__ATOMIC_RELEASE);
+	LazyFlagSync();	/* C and Q go into the saved STS */
+	SnapshotSave(SNAPSHOT_FILE);
+}
+
+static void snap_event(int arg) {
+	SnapshotTake();
+}
+
+static int ckpt_fd = -1;
+static long long ckpt_next;	/* rtc_now() of the next checkpoint */
+
+static bool ckpt_page_zero(ulong ppn) {
+	ushort *p = VolatileMemory->n_Pages[ppn];
+	int i;
+	for (i = 0; i < 1024; i++)
+		if (p[i])
+			return false;
+	return true;
+}
+
+/* Does page ppn go in the record? A base record leaves out pages that are still zero */
+static bool ckpt_want(ulong ppn, bool base) {
+	if (!(gDirty[ppn>>6] & (1ULL<<(ppn & 0x3f))))
+		return false;
+	return !base || !ckpt_page_zero(ppn);
+}
+
+/* Skip over the state sections of a record */
+static int ckpt_skip_state(int fd) {
+	struct snap_section sec;
+	while (!snap_read(fd,&sec,sizeof(sec))) {
+		if (sec.id == SNAP_END)
+			return 0;
+		if (lseek(fd,sec.len,SEEK_CUR) < 0)
+			return -1;
+	}
+	return -1;
+}
+
+/*
+ * ckpt_scan: Find the whole records of a checkpoint file, returns how many.
+ * Their offsets go in *recs if recs is not NULL (free it after), and
+ * *end is where the last of them ends.
+ */
+static int ckpt_scan(int fd, off_t **recs, off_t *end) {
+	struct ckpt_header hdr;
+	off_t size = lseek(fd,0,SEEK_END);
+	off_t next;
+	int n = 0;
+
+	*end = 0;
+	while (*end < size) {
+		if ((lseek(fd,*end,SEEK_SET) < 0) || snap_read(fd,&hdr,sizeof(hdr)) ||
+		    memcmp(hdr.magic,CKPT_MAGIC,sizeof(hdr.magic)) || (hdr.version != SNAP_VERSION) ||
+		    ckpt_skip_state(fd))
+			break;
+		next = lseek(fd,0,SEEK_CUR) + hdr.pages * (sizeof(ulong) + 1024*sizeof(ushort));
+		if (next > size)
+			break;
+		if (recs) {
+			*recs = realloc(*recs,(n+1) * sizeof(off_t));
+			(*recs)[n] = *end;
+		}
+		*end = next;
+		n++;
+	}
+	return n;
+}
+
+/*
+ * CheckpointSave - Append a record to the checkpoint file.
+ * The first one of a run is a base record, the rest only hold pages
+ * written since the record before. Writes through the TLB are not seen
+ * one by one, so the TLB is flushed to have pages marked dirty again.
+ * On a write error the record is cut off again and the pages stay dirty.
+ * Only call from the cpu thread between instructions.
+ */
+int CheckpointSave(void) {
+	struct ckpt_header hdr;
+	ulong ppn, npages = ND_Memsize >> 10;
+	off_t start;
+	bool base = false;
+	int res = 0;
+
+	if (ckpt_fd < 0) {
+		ckpt_fd = open(CHECKPOINT_FILE,O_RDWR | O_CREAT,0644);
+		if (ckpt_fd < 0) {
+			if (debug) fprintf(debugfile,"ERROR!!! checkpoint: cannot open %s: %s\n",CHECKPOINT_FILE,strerror(errno));
+			return -1;
+		}
+		/* A record cut short by a crash would hide everything after it */
+		ckpt_scan(ckpt_fd,NULL,&start);
+		if (ftruncate(ckpt_fd,start)) {
+			close(ckpt_fd);
+			ckpt_fd = -1;
+			return -1;
+		}
+		base = true;
+	}
+
+	memset(&hdr,0,sizeof(hdr));
+	memcpy(hdr.magic,CKPT_MAGIC,sizeof(hdr.magic));
+	hdr.version = SNAP_VERSION;
+	hdr.cputype = CurrentCPUType;
+	hdr.memsize = ND_Memsize;
+	hdr.instr_counter = instr_counter;
+	hdr.flags = (base) ? CKPT_BASE : 0;
+	for (ppn = 0; ppn < npages; ppn++)
+		if (ckpt_want(ppn,base))
+			hdr.pages++;
+
+	start = lseek(ckpt_fd,0,SEEK_END);	/* writes follow from here */
+	if (write(ckpt_fd,&hdr,sizeof(hdr)) != (ssize_t)sizeof(hdr))
+		res = -1;
+	res |= snap_write_state(ckpt_fd);
+	for (ppn = 0; (ppn < npages) && !res; ppn++) {
+		if (!ckpt_want(ppn,base))
+			continue;
+		if ((write(ckpt_fd,&ppn,sizeof(ppn)) != (ssize_t)sizeof(ppn)) ||
+		    (write(ckpt_fd,VolatileMemory->n_Pages[ppn],1024*sizeof(ushort)) != (ssize_t)(1024*sizeof(ushort))))
+			res = -1;
+	}
+	if (res) {
+		if (debug) fprintf(debugfile,"ERROR!!! checkpoint: writing %s failed: %s\n",CHECKPOINT_FILE,strerror(errno));
+		if (ftruncate(ckpt_fd,start) || base) { /* a half base record must not stay, start over */
+			close(ckpt_fd);
+			ckpt_fd = -1;
+		}
+		return -1;
+	}
+
+	memset(gDirty,0,sizeof(gDirty));
+	TLB_Flush();
+	if (debug) fprintf(debugfile,"checkpoint: %lu pages at instruction %.0f\n",hdr.pages,instr_counter);
+	if (debug) fflush(debugfile);
+	return 0;
+}
+
+/*
+ * ckpt_event: Look at the clock every CKPT_POLL instructions and checkpoint when it is time.
+ */
+static void ckpt_event(int arg) {
+	long long now = rtc_now();
+	EventAddCounted(CKPT_POLL,&ckpt_event,0);
+	if (now < ckpt_next)
+		return;
+	ckpt_next = now + (long long)CHECKPOINT_INTERVAL * 1000000000LL;
+	LazyFlagSync();	/* C and Q go into the saved STS */
+	CheckpointSave();
+}
+
+/*
+ * CheckpointLoad - Go back to record upto (from 0, -1 for the last) of a checkpoint file.
+ * Replays the pages of the records from the base record before it, and
+ * takes the state of record upto. Memory must still be all zero, as it is
+ * when called from program_load. A last record cut short, like after a
+ * crash, is ignored.
+ */
+int CheckpointLoad(char *filename, int upto) {
+	struct ckpt_header hdr;
+	off_t *recs = NULL, end;
+	ulong i, ppn;
+	int fd, n = 0, r, from;
+
+	fd = open(filename,O_RDONLY);
+	if (fd < 0) {
+		if (debug) fprintf(debugfile,"ERROR!!! checkpoint: cannot open %s: %s\n",filename,strerror(errno));
+		return -1;
+	}
+	n = ckpt_scan(fd,&recs,&end);
+	if ((upto < 0) || (upto >= n))
+		upto = n - 1;
+	for (from = upto; (from >= 0); from--) {
+		if ((pread(fd,&hdr,sizeof(hdr),recs[from]) == (ssize_t)sizeof(hdr)) && (hdr.flags & CKPT_BASE))
+			break;
+	}
+	if ((upto < 0) || (from < 0))
+		goto fail;
+
+	for (r = from; r <= upto; r++) {
+		if ((lseek(fd,recs[r],SEEK_SET) < 0) || snap_read(fd,&hdr,sizeof(hdr)))
+			goto fail;
+		if (r == upto) {
+			if (hdr.memsize > MEMPTSIZE*1024)
+				goto fail;
+			CurrentCPUType = hdr.cputype;
+			ND_Memsize = hdr.memsize;
+			instr_counter = hdr.instr_counter;
+			if (snap_read_state(fd))
+				goto fail;
+		} else if (ckpt_skip_state(fd))
+			goto fail;
+		for (i = 0; i < hdr.pages; i++) {
+			if (snap_read(fd,&ppn,sizeof(ppn)) || (ppn >= MEMPTSIZE) ||
+			    snap_read(fd,VolatileMemory->n_Pages[ppn],1024*sizeof(ushort)))
+				goto fail;
+		}
+	}
+	close(fd);
+	free(recs);
+	snap_restored();
+
+	if (debug) fprintf(debugfile,"checkpoint: restored record %d of %d from %s at instruction %.0f\n",upto,n,filename,instr_counter);
+	if (debug) fflush(debugfile);
+	return 0;
+
+fail:
+	if (debug) fprintf(debugfile,"ERROR!!! checkpoint: %s is damaged or from another build\n",filename);
+	if (debug) fflush(debugfile);
+	close(fd);
+	free(recs);
+	return -1;
+}
+
+/*
+ * SnapshotInit - Queue the snapshot_at snapshot, if there is one still
+ * to come, and the checkpoint clock.
+ */
+void SnapshotInit(void) {
+	EventCancel(&snap_event,0);	/* restored ones, we go by the config */
+	EventCancel(&ckpt_event,0);
+	if (SNAPSHOT_AT && ((double)SNAPSHOT_AT > instr_counter))
+		EventAddCounted((double)SNAPSHOT_AT - instr_counter,&snap_event,0);
+	if (CHECKPOINT_INTERVAL > 0) {
+		memset(gDirty,0xff,sizeof(gDirty));	/* the base record looks at all pages */
+		ckpt_next = rtc_now() + (long long)CHECKPOINT_INTERVAL * 1000000000LL;
+		EventAddCounted(CKPT_POLL,&ckpt_event,0);
+	}
+}
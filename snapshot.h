@@ -0,0 +1,121 @@
+/*
+ * nd100em - ND100 Virtual Machine
+ *
+ * Copyright (c) 2006-20011 Roger Abrahamsson
+ *
+ * This file is originated from the nd100em project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (in the main directory of the nd100em
+ * distribution in the file COPYING); if not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Machine snapshots. A snapshot file is a header, a list of sections
+ * holding cpu and device state, and then the memory image at a
+ * SNAP_ALIGN boundary so it can be mapped straight back in.
+ * The state sections are raw structs, so a snapshot is only good for
+ * the same emulator build on the same kind of host.
+ */
+#define SNAP_MAGIC	"ND100SNP"
+#define SNAP_VERSION	1
+#define SNAP_ALIGN	65536	/* memory image offset and padding, enough for any page size */
+
+struct snap_header {
+	char magic[8];
+	unsigned int version;
+	unsigned int cputype;
+	ulong memsize;		/* words in the memory image */
+	ulong memoffset;	/* file offset of the memory image */
+	double instr_counter;
+};
+
+struct snap_section {
+	unsigned int id;
+	unsigned int len;	/* bytes of data following */
+};
+
+enum {SNAP_END, SNAP_REGS, SNAP_PT, SNAP_IDENT, SNAP_RTC, SNAP_PAP, SNAP_TTY, SNAP_FLOPPY, SNAP_FDD, SNAP_EVENT};
+
+/* a queued event, with the handler given as its index in snap_events[] */
+struct snap_event {
+	double when;
+	int func;
+	int arg;
+};
+
+/*
+ * A checkpoint file is a row of records, each a ckpt_header, the state
+ * sections and then the pages, every one its page number (a ulong) and
+ * its 1K words. A base record starts from all zero memory, the ones after
+ * it only have the pages written since the record before.
+ */
+#define CKPT_MAGIC	"ND100CKP"
+#define CKPT_BASE	0x01		/* flags: replay starts here */
+#define CKPT_POLL	100000		/* instructions between looks at the clock */
+
+struct ckpt_header {
+	char magic[8];
+	unsigned int version;
+	unsigned int cputype;
+	ulong memsize;
+	ulong pages;		/* pages after the state sections */
+	double instr_counter;
+	unsigned int flags;
+};
+
+char *SNAPSHOT_FILE = NULL;	/* "snapshot" in the config */
+int SNAPSHOT_AT = 0;		/* "snapshot_at", take one after this many instructions */
+bool gSnapReq = false;		/* snapshot asked for, taken by the cpu loop */
+char *CHECKPOINT_FILE = NULL;	/* "checkpoint" */
+int CHECKPOINT_INTERVAL = 0;	/* "checkpoint_interval", seconds between checkpoints, 0 for none */
+int CHECKPOINT_RESTORE = -1;	/* "checkpoint_restore", record to go back to, -1 for the last */
+
+extern _NDRAM_ *VolatileMemory;
+extern ulong ND_Memsize;
+extern _CPUTYPE_ CurrentCPUType;
+extern _RUNMODE_ CurrentCPURunMode;
+extern struct CpuRegs *gReg;
+extern union NewPT *gPT;
+extern unsigned long long gIdent[4][IDENT_WORDS];
+extern bool gIntPending;
+extern struct rtc_data *sys_rtc;
+extern struct display_panel *gPAP;
+extern struct tty_io_data (*tty_arr[256]);
+extern void (*iodata[65536]);
+extern double instr_counter;
+extern int RTC_VIRTUAL;
+extern unsigned int RTC_IPT;
+extern int debug;
+extern FILE *debugfile;
+
+extern void EventAdd(double delay, void (*func)(int), int arg);
+extern void EventAddCounted(double delay, void (*func)(int), int arg);
+extern void EventCancel(void (*func)(int), int arg);
+extern void EventClear(void);
+extern bool EventPeek(int i, double *when, void (**func)(int), int *arg);
+extern void rtc_vtick(int arg);
+extern long long rtc_now(void);
+extern void LazyFlagSync(void);
+extern void HotStateSync(void);
+extern void TLB_Flush(void);
+extern void CpuWake(void);
+
+int SnapshotSave(char *filename);
+int SnapshotLoad(char *filename);
+void SnapshotRequest(void);
+void SnapshotTake(void);
+void SnapshotInit(void);
+int CheckpointSave(void);
+int CheckpointLoad(char *filename, int upto);
@@ -0,0 +1,118 @@
+/*
+ * nd100em - ND100 Virtual Machine
+ *
+ * Instruction tests: small guest programs run from address 0 until WAIT,
+ * with interrupts off, then the registers and memory are checked.
+ * Build and run with "make test".
+ *
+ * This file is originated from the nd100em project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (in the main directory of the nd100em
+ * distribution in the file COPYING); if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include "../nd100.h"
+
+extern struct CpuRegs *gReg;
+extern _NDRAM_ *VolatileMemory;
+extern _RUNMODE_ CurrentCPURunMode;
+extern _CPUTYPE_ CurrentCPUType;
+extern void setup_cpu(void);
+extern void Setup_Instructions(void);
+extern void cpurun(void);
+
+#define WAIT	0151000
+
+static int failed;
+
+/* Load prog at 0, clear the level 0 registers and run until WAIT */
+static void run(const ushort *prog, int n) {
+	memcpy(&VolatileMemory->n_Array[0],prog,n*sizeof(ushort));
+	memset(gReg->reg[0],0,sizeof(gReg->reg[0]));
+	CurrentCPURunMode = RUN;
+	cpurun();
+}
+
+static void check(const char *test, const char *what, ushort got, ushort want) {
+	if (got != want) {
+		printf("FAIL %s: %s is %06o, expected %06o\n",test,what,got,want);
+		failed++;
+	}
+}
+
+static void test_tset(void) {
+	static const ushort prog[] = {
+		0054003,	/* LDX *3 */
+		0140123,	/* TSET */
+		WAIT,
+		0000100,
+	};
+	VolatileMemory->n_Array[0100] = 5;
+	run(prog,sizeof(prog)/sizeof(prog[0]));
+	check("TSET","A",gReg->reg[0][_A],5);
+	check("TSET","(X)",VolatileMemory->n_Array[0100],0177777);
+	check("TSET","P",gReg->reg[0][_P],3);
+}
+
+static void test_rdus(void) {
+	static const ushort prog[] = {
+		0054003,	/* LDX *3 */
+		0140127,	/* RDUS */
+		WAIT,
+		0000100,
+	};
+	VolatileMemory->n_Array[0100] = 012345;
+	run(prog,sizeof(prog)/sizeof(prog[0]));
+	check("RDUS","A",gReg->reg[0][_A],012345);
+	check("RDUS","(X)",VolatileMemory->n_Array[0100],012345);
+	check("RDUS","P",gReg->reg[0][_P],3);
+}
+
+/* FMU with an exponent overflow saturates and sets the error indicator Z */
+static void test_fmu_overflow(void) {
+	static const ushort prog[] = {
+		0034003,	/* LDF *3 */
+		0110002,	/* FMU *2 */
+		WAIT,
+		0077777,	/* largest exponent, mantissa 0.5 */
+		0100000,
+		0000000,
+	};
+	run(prog,sizeof(prog)/sizeof(prog[0]));
+	check("FMU overflow","T",gReg->reg[0][_T],0077777);
+	check("FMU overflow","A",gReg->reg[0][_A],0177777);
+	check("FMU overflow","D",gReg->reg[0][_D],0177777);
+	check("FMU overflow","Z",(gReg->reg[0][_STS] >> _Z) & 1,1);
+}
+
+int main(int argc, char *argv[]) {
+	CurrentCPUType = ND100CX;
+	setup_cpu();
+	Setup_Instructions();
+
+	test_tset();
+	test_rdus();
+	test_fmu_overflow();
+
+	if (failed) {
+		printf("%d checks failed\n",failed);
+		return 1;
+	}
+	printf("All instruction tests passed\n");
+	return 0;
+}
@@ -0,0 +1,56 @@
+/*
+ * nd100em - ND100 Virtual Machine
+ *
+ * Writes the golden vectors for "make floattest" to stdout: generated
+ * operands for each float routine with the result of the reference routine
+ * in test/floatref.c. "make floatvec" regenerates test/floatvec.txt.
+ *
+ * This file is originated from the nd100em project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (in the main directory of the nd100em
+ * distribution in the file COPYING); if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include "../nd100.h"
+#include "floatref.h"
+
+extern void setup_cpu(void);
+
+#define NVEC	500	/* vectors per routine */
+#define SEED	0x5d0f1e2a3b4c6978ULL	/* not the floattest seed, so these are other operands */
+
+int main(int argc, char *argv[]) {
+	ushort a[3], b[3], r[3];
+	int i, n, rc;
+
+	setup_cpu();
+	float_gen_seed(SEED);
+	printf("# Golden vectors for make floattest, written by test/floatgen (make floatvec).\n");
+	printf("# Results are from the reference routines in test/floatref.c.\n");
+	printf("# routine  a: T A D  b: T A D  result: T A D  return value\n");
+	printf("# NLZ: integer in a A, scaling factor in b T. DNZ: scaling factor in b T, returns Z.\n");
+	for (n=0;n<FLOAT_ROUTINES;n++) {
+		for (i=0;i<NVEC;i++) {
+			float_gen_operands(float_routines[n].name,a,b);
+			printf("%s %06o %06o %06o  %06o %06o %06o  ",float_routines[n].name,
+				a[0],a[1],a[2],b[0],b[1],b[2]);
+			rc = float_routines[n].ref(a,b,r);
+			printf("%06o %06o %06o  %d\n",r[0],r[1],r[2],rc);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,476 @@
+/*
+ * nd100em - ND100 Virtual Machine
+ *
+ * Reference float routines and operand generation for test/floattest.c and
+ * test/floatgen.c. The ref_* routines are the long double FMU, FDV, NLZ and
+ * DNZ and the FAD that float.c had before the integer kernels went in, only
+ * without the debug output. The golden vectors in test/floatvec.txt are made
+ * from them.
+ *
+ * This file is originated from the nd100em project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (in the main directory of the nd100em
+ * distribution in the file COPYING); if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include "../nd100.h"
+#include "floatref.h"
+
+extern struct CpuHot gHot;
+extern struct CpuRegs *gReg;
+extern void setbit(ushort regnum, ushort stsbit, char val);
+extern int NDFloat_Add(ushort *p_a, ushort *p_b, ushort *p_r);
+extern int NDFloat_Sub(ushort *p_a, ushort *p_b, ushort *p_r);
+extern int NDFloat_Mul(ushort *p_a, ushort *p_b, ushort *p_r);
+extern int NDFloat_Div(ushort *p_a, ushort *p_b, ushort *p_r);
+extern int old_NDFloat_Mul(ushort *p_a, ushort *p_b, ushort *p_r);
+extern int old_NDFloat_Div(ushort *p_a, ushort *p_b, ushort *p_r);
+extern void DoNLZ(char scaling);
+extern void DoDNZ(char scaling);
+extern void old_DoNLZ(char scaling);
+extern void old_DoDNZ(char scaling);
+
+/* routine to sort out a missing powl in freebsd */
+static long double pow2l(int i){
+	long double r;
+#if !(defined __FreeBSD__ || defined BSD )
+	r=powl(2,(long double)i);
+#else
+#endif
+	return r;
+}
+
+/*
+ * ld_to_ndmant
+ *
+ * converts a long double normalised mantissa
+ * to ND100 mantissa 32 bits
+ */
+static unsigned int ld_to_ndmant(long double mant){
+	int i,j;
+	long double k,l;
+	unsigned int res =0;
+	j=31;
+	i=-1;
+	l=0; k=0;
+	for(i=-1; i>=-32;i--) {
+		l=k+pow2l(i);
+		if (l>mant) { /* 0 in this bit pos */
+			res &= ~(1<<j);
+		} else { /* 1 in this bit pos */
+			res |= 1<<j;
+			k=l;
+		}
+		j--;
+	}
+	return res;
+}
+
+/*
+ * ndmant_to_ld
+ *
+ * converts a ND100 mantissa to a long double
+ *
+ */
+static void ndmant_to_ld(unsigned int ndmant, long double *val) {
+	int i,j;
+	long double k,l;
+	j=31;
+	k=0;
+	for(i=-1; i>=-32;i--) {
+		l=((ndmant>>j) &0x01)* pow2l(i);
+		k+=l;
+		j--;
+	}
+	*val = k;
+	return;
+}
+
+int ref_NDFloat_Add(ushort* p_a,ushort* p_b,ushort* p_r) {
+	bool sign_a,sign_b,sign_r;
+	bool is_exact, do_nlz;
+	int exp_a, exp_b, exp_r;
+	unsigned  int delta_e;
+	unsigned int a, b, r;
+
+	bool has_carry = false;
+
+	/* Null sign bit, subtract offset */
+	exp_a = (p_a[0] & ~(1<<15)) - (1<<14);
+	exp_b = (p_b[0] & ~(1<<15)) - (1<<14);
+
+	/* Pluck out sign bit */
+	sign_a = (p_a[0] & (1<<15)) ? true : false;
+	sign_b = (p_b[0] & (1<<15)) ? true : false;
+
+	/* Convert to unsigned 32 bit numbers for easy handling */
+	/* Host machine is little endian */
+	a = ((p_a[1] & 0xffff)<<16) | (p_a[2] & 0xffff);
+	b = ((p_b[1] & 0xffff)<<16) | (p_b[2] & 0xffff);
+
+	is_exact = true;
+
+	if(exp_a > exp_b) {
+		delta_e = exp_a - exp_b;
+		/* We will shift b right by delta_e, so check if we will shift out any ones first */
+		if (b & (~(0xffffffff << delta_e)))
+			is_exact = false;	/* Yes, take note of it */
+		b = b >> delta_e;
+		exp_r = exp_a;
+	} else	if(exp_b > exp_a) {
+		delta_e = exp_b - exp_a;
+		/* We will shift a right by delta_e, so check if we will shift out any ones first */
+		if (a & (~(0xffffffff << delta_e)))
+			is_exact = false;	/* Yes, take note of it */
+		a = a >> delta_e;
+		exp_r= exp_b;
+	} else {
+		delta_e = 0;
+		exp_r= exp_a;
+	}
+
+	if(sign_a == sign_b) { /* Same sign so addition no matter what */
+		sign_r =  (sign_a) ? true : false;
+		r = a + b;
+
+		if ( a > UINT_MAX - b)	/* a + b would overflow */
+			has_carry = true;
+	} else {	/* Different signs, so we subtract the smaller number and flip sign depending on which is which */
+		if (a >= b) {
+			r = a - b;
+			sign_r = (sign_a ) ?  true : false ;
+		} else {
+			r = b - a;
+			sign_r = (sign_b ) ?  true : false ;
+		}
+	}
+	r = (is_exact) ? r : r | 0x01;
+
+	if (has_carry) {
+		exp_r++;
+		r = (r >> 1) | (0x01 << 31);	/* Adjust result */
+	}
+
+	/* Normalize result */
+	if ( r != 0 ) {
+		do {
+			do_nlz = (!(r  & 0x80000000)) ? true : false; /* Highest bit is zero.. adjust */
+			if (do_nlz) {
+				r = r << 1;
+				exp_r--;
+			}
+		} while (do_nlz == true);
+	} else {
+		exp_r = 0;
+		sign_r = false;
+	}
+
+	if(exp_r > ((1<<14) - 1)) {
+		/* Overflow */
+		p_r[0] = ((sign_r) ? ((unsigned short int)1<<15) : 0) | 0x7FFF;
+		p_r[1] = 0xFFFF;
+		p_r[2] = 0xFFFF;
+		return -2;
+	}
+	if(exp_r < -(1<<14)) {
+		/* :TODO: Underflow */
+		p_r[0] = ((sign_r) ? ((unsigned short int)1<<15) : 0);
+		p_r[1] = 0;
+		p_r[2] = 0;
+		return -3;
+	}
+
+	p_r[0] = ((sign_r) ? ((unsigned short int)1<<15) : 0) | ((unsigned)exp_r + ((unsigned short int)1<<14));
+	p_r[1] = r >> 16;
+	p_r[2] = (r & 0xFFFF);
+
+	/* Make ND standardized 0 */
+	if ((p_r[0]== 040000) & (p_r[1]== 000000) & (p_r[2]== 000000))
+		p_r[0]= 000000;
+
+	if (is_exact)
+		return 0;
+	else
+		return -1;
+}
+
+/*
+ * The long double FSB rounded differently from FAD. FSB is now FAD with the
+ * sign of the subtrahend flipped, so that is what it is checked against.
+ */
+int ref_NDFloat_Sub(ushort *p_a, ushort *p_b, ushort *p_r) {
+	ushort neg_b[3];
+	neg_b[0] = p_b[0] ^ 0x8000;
+	neg_b[1] = p_b[1];
+	neg_b[2] = p_b[2];
+	return ref_NDFloat_Add(p_a,neg_b,p_r);
+}
+
+int ref_NDFloat_Div(unsigned short int* p_a,unsigned short int* p_b,unsigned short int* p_r) {
+	long double a,b,r;
+	int exp;
+	long double mant;
+	long double k;
+	unsigned int res;
+
+	bool isneg_a = (p_a[0] & 0x8000)>> 15;
+	bool isneg_b = (p_b[0] & 0x8000)>> 15;
+	bool isneg_r = false;
+
+	sshort exp_a = p_a[0] & 0x7fff;
+	exp_a = exp_a - 16384; /* offset for ND100 exp */
+	ndmant_to_ld(((unsigned int)p_a[1]<<16 | p_a[2]), &k);
+	a = k * pow2l((int)exp_a);
+	a = (isneg_a) ? -a : a;
+
+	sshort exp_b = p_b[0] & 0x7fff;
+	exp_b = exp_b - 16384; /* offset for ND100 exp */
+	ndmant_to_ld(((unsigned int)p_b[1]<<16 | p_b[2]), &k);
+	b = k * pow2l((int)exp_b);
+	b = (isneg_b) ? -b : b;
+
+	if ((p_b[1]==0) && (p_b[2]==0)) { /*division by zero */
+		/* TODO:: Mostly guesswork for now */
+		p_r[0] = 0x7fff;
+		p_r[1] = 0xffff;
+		p_r[2] = 0xffff;
+		return(1);
+	} else {
+		r= a / b;
+	}
+	mant = frexpl(r,&exp); /* normalise */
+	if (mant < 0) {/* negative number */
+		mant = -mant;
+		isneg_r = true;
+	}
+
+	res = ld_to_ndmant(mant);
+
+	p_r[0] = (ushort) 16384 + exp;
+	p_r[0] |= (isneg_r) ? 1<<15 : 0;
+	p_r[1] = (res >> 16) & 0xffff;
+	p_r[2] = res & 0xffff;
+	if ((p_r[2] == 0) &&(p_r[1] == 0)) /* result is 0 */
+		p_r[0] = 0; /* set exp and sign -> 0 too */
+	return(0);
+}
+
+int ref_NDFloat_Mul(unsigned short int* p_a,unsigned short int* p_b,unsigned short int* p_r) {
+	long double a,b,r;
+	int exp;
+	long double mant;
+	long double k;
+	unsigned int res;
+
+	bool isneg_a = (p_a[0] & 0x8000)>> 15;
+	bool isneg_b = (p_b[0] & 0x8000)>> 15;
+	bool isneg_r = false;
+
+	sshort exp_a = p_a[0] & 0x7fff;
+	exp_a = exp_a - 16384; /* offset for ND100 exp */
+	ndmant_to_ld(((unsigned int)p_a[1]<<16 | p_a[2]), &k);
+	a = k * pow2l((int)exp_a);
+	a = (isneg_a) ? -a : a;
+
+	sshort exp_b = p_b[0] & 0x7fff;
+	exp_b = exp_b - 16384; /* offset for ND100 exp */
+	ndmant_to_ld(((unsigned int)p_b[1]<<16 | p_b[2]), &k);
+	b = k * pow2l((int)exp_b);
+	b = (isneg_b) ? -b : b;
+
+	r= a * b;
+	mant = frexpl(r,&exp); /* normalise */
+	if (mant < 0) {/* negative number */
+		mant = -mant;
+		isneg_r = true;
+	}
+
+	res = ld_to_ndmant(mant);
+
+	p_r[0] = (ushort) 16384 + exp;
+	p_r[0] |= (isneg_r) ? 1<<15 : 0;
+	p_r[1] = (res >> 16) & 0xffff;
+	p_r[2] = res & 0xffff;
+	if ((p_r[2] == 0) &&(p_r[1] == 0)) /* result is 0 */
+		p_r[0] = 0; /* set exp and sign -> 0 too */
+	return(0);
+}
+
+void ref_DoNLZ (char scaling) {
+	if (gA==0) { /* special case, return with TAD=0 */
+		gT=0;
+		gA=0;
+		gD=0;
+		return;
+	}
+	bool isneg = (gA & 0x8000)>> 15;
+	int e,val;
+	long double mantissa,x;
+	int i,j;
+	long double k,l;
+	ushort res = 0;
+	e = (int)scaling - 16; /* adjust offset, +16 = 2^0 */
+	val = (int)(sshort)gA;
+	x=(long double)val * pow2l(e);
+	mantissa = frexpl(x,&e); /* normalise */
+	if (mantissa < 0) /* negative number, ignore since we got sign bit already */
+		mantissa = -mantissa;
+	j=15;
+	i=-1;
+	l=0; k=0;
+	for(i=-1; i>-16;i--) {
+		l=k+pow2l(i);
+		if (l>mantissa) { /* 0 in this bit pos */
+			res &= ~(1<<j);
+		} else { /* 1 in this bit pos */
+			res |= 1<<j;
+			k=l;
+		}
+		j--;
+	}
+	gT = (ushort) 16384 + e;
+	gT |= (isneg) ? 1<<15 : 0;
+	gA = res;
+	gD = 0;
+}
+
+void ref_DoDNZ(char scaling) {
+	bool isneg = (gT & 0x8000)>> 15;
+	sshort exp = gT & 0x7fff;
+	exp = exp - 16384; /* offset for ND100 exp */
+	ulong mantissa = ((unsigned long)gA<<16) | gD;
+	int j,k;
+	long double i,t;
+	k=31;
+	i=0;
+	for(j=-1; j>-32;j--) {
+		t=((mantissa>>k) &0x01)* pow2l(j);
+		i+=t;
+		k--;
+	}
+	i= i* pow2l((int)exp);
+	i = (isneg) ? -i : i;
+	/* ok we now have the ND float in long double format */
+	exp= scaling + 16;
+	i = i * pow2l((int)exp);
+	i = truncl(i);
+	gA= (sshort) i;
+	j= (int) i;
+	if (abs(j) > 32767)	/* Overflow */
+		setbit(_STS,_Z,1);
+	gT=0;
+	gD=0;
+}
+
+/* NLZ and DNZ work on T, A and D, with the scaling factor in b[0] */
+static int nlz_with(void (*nlz)(char), ushort *p_a, ushort *p_b, ushort *p_r) {
+	gA = p_a[1];
+	nlz((char)p_b[0]);
+	p_r[0] = gT; p_r[1] = gA; p_r[2] = gD;
+	return 0;
+}
+
+/* DNZ returns the error indicator Z, which it sets on overflow */
+static int dnz_with(void (*dnz)(char), ushort *p_a, ushort *p_b, ushort *p_r) {
+	gReg->reg[CurrLEVEL][_STS] &= ~(1<<_Z);
+	gT = p_a[0]; gA = p_a[1]; gD = p_a[2];
+	dnz((char)p_b[0]);
+	p_r[0] = gT; p_r[1] = gA; p_r[2] = gD;
+	return (gReg->reg[CurrLEVEL][_STS] >> _Z) & 1;
+}
+
+static int nlz(ushort *p_a, ushort *p_b, ushort *p_r) { return nlz_with(DoNLZ,p_a,p_b,p_r); }
+static int ref_nlz(ushort *p_a, ushort *p_b, ushort *p_r) { return nlz_with(ref_DoNLZ,p_a,p_b,p_r); }
+static int old_nlz(ushort *p_a, ushort *p_b, ushort *p_r) { return nlz_with(old_DoNLZ,p_a,p_b,p_r); }
+static int dnz(ushort *p_a, ushort *p_b, ushort *p_r) { return dnz_with(DoDNZ,p_a,p_b,p_r); }
+static int ref_dnz(ushort *p_a, ushort *p_b, ushort *p_r) { return dnz_with(ref_DoDNZ,p_a,p_b,p_r); }
+static int old_dnz(ushort *p_a, ushort *p_b, ushort *p_r) { return dnz_with(old_DoDNZ,p_a,p_b,p_r); }
+
+const struct FloatRoutine float_routines[FLOAT_ROUTINES] = {
+	{ "FAD", NDFloat_Add, ref_NDFloat_Add, NULL },
+	{ "FSB", NDFloat_Sub, ref_NDFloat_Sub, NULL },
+	{ "FMU", NDFloat_Mul, ref_NDFloat_Mul, old_NDFloat_Mul },
+	{ "FDV", NDFloat_Div, ref_NDFloat_Div, old_NDFloat_Div },
+	{ "NLZ", nlz, ref_nlz, old_nlz },
+	{ "DNZ", dnz, ref_dnz, old_dnz },
+};
+
+const struct FloatRoutine *float_routine(const char *name) {
+	int r;
+	for (r=0;r<FLOAT_ROUTINES;r++)
+		if (!strcmp(float_routines[r].name,name))
+			return &float_routines[r];
+	return NULL;
+}
+
+static unsigned long long rng = 0x9e3779b97f4a7c15ULL;
+
+void float_gen_seed(unsigned long long seed) {
+	rng = (seed) ? seed : 1;
+}
+
+static unsigned int rand32(void) {
+	rng ^= rng << 13;
+	rng ^= rng >> 7;
+	rng ^= rng << 17;
+	return (unsigned int)(rng >> 16);
+}
+
+/*
+ * A float with exponent exp and a random sign and mantissa. One in 16 is the
+ * ND standard 0, and one in 16 has an unnormalised mantissa.
+ */
+static void gen_float(ushort *p, int exp) {
+	unsigned int m = rand32() | 0x80000000;
+	switch (rand32() % 16) {
+	case 0:
+		p[0] = p[1] = p[2] = 0;
+		return;
+	case 1:
+		m >>= 1 + rand32() % 16;
+		break;
+	}
+	p[0] = (ushort)((exp + 16384) & 0x7fff) | ((rand32() & 1) ? 0x8000 : 0);
+	p[1] = m >> 16;
+	p[2] = m & 0xffff;
+}
+
+/*
+ * Operands for routine name. Exponents stay well inside the range, where
+ * the reference routines give the same bits as the ND-100 should: FAD and
+ * FSB alignment shifts stay below 32, and DNZ results fit in 16 bits.
+ * Overflow, underflow and the other corner cases are in the edge table of
+ * test/floattest.c instead.
+ */
+void float_gen_operands(const char *name, ushort *a, ushort *b) {
+	int e = (int)(rand32() % 512) - 256;
+	int s;
+	if (!strcmp(name,"NLZ")) {
+		a[0] = 0; a[1] = rand32() & 0xffff; a[2] = 0;
+		b[0] = (rand32() & 1) ? 020 : (ushort)(sshort)(signed char)rand32(); b[1] = 0; b[2] = 0;
+	} else if (!strcmp(name,"DNZ")) {
+		s = (rand32() & 1) ? -020 : (int)(rand32() % 48) - 40;	/* scaling factor */
+		gen_float(a,(int)(rand32() % (32 - s)) - 32);	/* below 2**(-1-s), so the result is below 2**15 */
+		b[0] = (ushort)s; b[1] = 0; b[2] = 0;
+	} else {
+		gen_float(a,e);
+		gen_float(b,(!strcmp(name,"FAD") || !strcmp(name,"FSB")) ? e - 31 + (int)(rand32() % 63) : (int)(rand32() % 512) - 256);
+	}
+}
@@ -0,0 +1,42 @@
+/*
+ * nd100em - ND100 Virtual Machine
+ *
+ * Shared by test/floattest.c and test/floatgen.c, see test/floatref.c.
+ *
+ * This file is originated from the nd100em project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (in the main directory of the nd100em
+ * distribution in the file COPYING); if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * A float routine as op(a,b,r), with its return value. NLZ takes the integer
+ * in a[1], DNZ the float in a, both the scaling factor in b[0], and DNZ
+ * returns the error indicator Z.
+ */
+typedef int (*FloatOp)(ushort *p_a, ushort *p_b, ushort *p_r);
+
+struct FloatRoutine {
+	const char *name;
+	FloatOp op;	/* float.c */
+	FloatOp ref;	/* the long double code float.c had before, in floatref.c */
+	FloatOp old;	/* the old_* code still in float.c, or NULL */
+};
+
+#define FLOAT_ROUTINES	6
+
+extern const struct FloatRoutine float_routines[FLOAT_ROUTINES];
+extern const struct FloatRoutine *float_routine(const char *name);
+extern void float_gen_seed(unsigned long long seed);
+extern void float_gen_operands(const char *name, ushort *a, ushort *b);
@@ -0,0 +1,232 @@
+/*
+ * nd100em - ND100 Virtual Machine
+ *
+ * Floating point conformance and throughput: checks FAD, FSB, FMU, FDV, NLZ
+ * and DNZ against a table of edge cases with known results, against the
+ * golden vectors in test/floatvec.txt, and against the reference routines
+ * in test/floatref.c over a million generated operands each. Any mismatch
+ * fails the run. Prints ops/s for float.c, the reference routines and the
+ * old_* routines still in float.c, and how often the old_* ones differ.
+ * Build and run with "make floattest".
+ *
+ * This file is originated from the nd100em project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (in the main directory of the nd100em
+ * distribution in the file COPYING); if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include "../nd100.h"
+#include "floatref.h"
+
+extern void setup_cpu(void);
+
+#define NGEN		1000000	/* generated operands per routine */
+#define VECFILE		"test/floatvec.txt"
+#define MAXREPORT	5	/* mismatches listed per routine and check */
+
+/*
+ * Edge cases with the result we expect, T A D for each operand. For NLZ a is
+ * the integer in A, for DNZ the float to convert, and b[0] is the scaling
+ * factor: NLZ 20 and DNZ -20 for integers. Here the reference routines often
+ * disagree, as they wrapped the exponent on overflow and shifted by 32 or
+ * more modulo 32, so the results were worked out by hand.
+ */
+struct Vector {
+	const char *op;
+	const char *what;
+	ushort a[3], b[3], want[3];
+	int rc;
+};
+
+static const struct Vector edge[] = {
+	{ "FAD", "ND standard 0 + ND standard 0",	{ 0000000, 0000000, 0000000 }, { 0000000, 0000000, 0000000 }, { 0000000, 0000000, 0000000 }, 0 },
+	{ "FAD", "0 with exponent + 1.0",		{ 0040000, 0000000, 0000000 }, { 0040001, 0100000, 0000000 }, { 0040001, 0100000, 0000000 }, 0 },
+	{ "FAD", "1.0 + -1.0",				{ 0040001, 0100000, 0000000 }, { 0140001, 0100000, 0000000 }, { 0000000, 0000000, 0000000 }, 0 },
+	{ "FAD", "max exponent + max exponent",		{ 0077777, 0177777, 0177777 }, { 0077777, 0177777, 0177777 }, { 0077777, 0177777, 0177777 }, -2 },
+	{ "FAD", "min exponent + min exponent",		{ 0000000, 0100000, 0000000 }, { 0000000, 0100000, 0000000 }, { 0000001, 0100000, 0000000 }, 0 },
+	{ "FAD", "-1.0 + 3.0, mixed signs",		{ 0140001, 0100000, 0000000 }, { 0040002, 0140000, 0000000 }, { 0040002, 0100000, 0000000 }, 0 },
+	{ "FAD", "1.0 + 2**-31, shift of 31",		{ 0040001, 0100000, 0000000 }, { 0037742, 0100000, 0000000 }, { 0040001, 0100000, 0000001 }, 0 },
+	{ "FAD", "1.0 + 2**-32, shift of 32",		{ 0040001, 0100000, 0000000 }, { 0037741, 0100000, 0000000 }, { 0040001, 0100000, 0000001 }, -1 },
+	{ "FAD", "1.0 + 2**-40, shift of 40",		{ 0040001, 0100000, 0000000 }, { 0037731, 0100000, 0000000 }, { 0040001, 0100000, 0000001 }, -1 },
+	{ "FAD", "2**-40 + 1.0, shift of 40",		{ 0037731, 0100000, 0000000 }, { 0040001, 0100000, 0000000 }, { 0040001, 0100000, 0000001 }, -1 },
+	{ "FAD", "0.5 unnormalised + ND standard 0",	{ 0040001, 0040000, 0000000 }, { 0000000, 0000000, 0000000 }, { 0040000, 0100000, 0000000 }, 0 },
+	{ "FSB", "1.0 - 1.0",				{ 0040001, 0100000, 0000000 }, { 0040001, 0100000, 0000000 }, { 0000000, 0000000, 0000000 }, 0 },
+	{ "FSB", "1.0 - 2**-40, shift of 40",		{ 0040001, 0100000, 0000000 }, { 0037731, 0100000, 0000000 }, { 0040001, 0100000, 0000001 }, -1 },
+	{ "FSB", "1.0 - 1/3, inexact",			{ 0040001, 0100000, 0000000 }, { 0037777, 0125252, 0125253 }, { 0040000, 0125252, 0125256 }, -1 },
+	{ "FSB", "-max exponent - max exponent",	{ 0177777, 0177777, 0177777 }, { 0077777, 0177777, 0177777 }, { 0177777, 0177777, 0177777 }, -2 },
+	{ "FMU", "ND standard 0 * 1.0",			{ 0000000, 0000000, 0000000 }, { 0040001, 0100000, 0000000 }, { 0000000, 0000000, 0000000 }, 0 },
+	{ "FMU", "max exponent * 2.0, overflow",	{ 0077777, 0100000, 0000000 }, { 0040002, 0100000, 0000000 }, { 0077777, 0177777, 0177777 }, -2 },
+	{ "FMU", "min exponent * 0.5, underflow",	{ 0000000, 0100000, 0000000 }, { 0040000, 0100000, 0000000 }, { 0000000, 0000000, 0000000 }, -3 },
+	{ "FMU", "-1.5 * 1.5, mixed signs",		{ 0140001, 0140000, 0000000 }, { 0040001, 0140000, 0000000 }, { 0140002, 0110000, 0000000 }, 0 },
+	{ "FMU", "0.5 unnormalised * 1.0",		{ 0040001, 0040000, 0000000 }, { 0040001, 0100000, 0000000 }, { 0040000, 0100000, 0000000 }, 0 },
+	{ "FDV", "1.0 / ND standard 0",			{ 0040001, 0100000, 0000000 }, { 0000000, 0000000, 0000000 }, { 0077777, 0177777, 0177777 }, 1 },
+	{ "FDV", "ND standard 0 / 1.0",			{ 0000000, 0000000, 0000000 }, { 0040001, 0100000, 0000000 }, { 0000000, 0000000, 0000000 }, 0 },
+	{ "FDV", "1.0 / 3.0, truncated",		{ 0040001, 0100000, 0000000 }, { 0040002, 0140000, 0000000 }, { 0037777, 0125252, 0125252 }, 0 },
+	{ "FDV", "max exponent / 0.5, overflow",	{ 0077777, 0100000, 0000000 }, { 0040000, 0100000, 0000000 }, { 0077777, 0177777, 0177777 }, -2 },
+	{ "FDV", "min exponent / 2.0, underflow",	{ 0000000, 0100000, 0000000 }, { 0040002, 0100000, 0000000 }, { 0000000, 0000000, 0000000 }, -3 },
+	{ "FDV", "-1.0 / 3.0, mixed signs",		{ 0140001, 0100000, 0000000 }, { 0040002, 0140000, 0000000 }, { 0137777, 0125252, 0125252 }, 0 },
+	{ "FDV", "1.0 / 0.5 unnormalised",		{ 0040001, 0100000, 0000000 }, { 0040001, 0040000, 0000000 }, { 0040002, 0100000, 0000000 }, 0 },
+	{ "NLZ", "0",					{ 0000000, 0000000, 0000000 }, { 0000020, 0000000, 0000000 }, { 0000000, 0000000, 0000000 }, 0 },
+	{ "NLZ", "1",					{ 0000000, 0000001, 0000000 }, { 0000020, 0000000, 0000000 }, { 0040001, 0100000, 0000000 }, 0 },
+	{ "NLZ", "32767",				{ 0000000, 0077777, 0000000 }, { 0000020, 0000000, 0000000 }, { 0040017, 0177776, 0000000 }, 0 },
+	{ "NLZ", "-1",					{ 0000000, 0177777, 0000000 }, { 0000020, 0000000, 0000000 }, { 0140001, 0100000, 0000000 }, 0 },
+	{ "NLZ", "-32768",				{ 0000000, 0100000, 0000000 }, { 0000020, 0000000, 0000000 }, { 0140020, 0100000, 0000000 }, 0 },
+	{ "NLZ", "1, scaling factor 0",			{ 0000000, 0000001, 0000000 }, { 0000000, 0000000, 0000000 }, { 0037761, 0100000, 0000000 }, 0 },
+	{ "DNZ", "ND standard 0",			{ 0000000, 0000000, 0000000 }, { 0177760, 0000000, 0000000 }, { 0000000, 0000000, 0000000 }, 0 },
+	{ "DNZ", "1.0",					{ 0040001, 0100000, 0000000 }, { 0177760, 0000000, 0000000 }, { 0000000, 0000001, 0000000 }, 0 },
+	{ "DNZ", "32767.0",				{ 0040017, 0177776, 0000000 }, { 0177760, 0000000, 0000000 }, { 0000000, 0077777, 0000000 }, 0 },
+	{ "DNZ", "-32767.0",				{ 0140017, 0177776, 0000000 }, { 0177760, 0000000, 0000000 }, { 0000000, 0100001, 0000000 }, 0 },
+	{ "DNZ", "32768.0, overflow",			{ 0040020, 0100000, 0000000 }, { 0177760, 0000000, 0000000 }, { 0000000, 0100000, 0000000 }, 1 },
+	{ "DNZ", "-32768.0, overflow",			{ 0140020, 0100000, 0000000 }, { 0177760, 0000000, 0000000 }, { 0000000, 0100000, 0000000 }, 1 },
+	{ "DNZ", "max exponent, overflow",		{ 0077777, 0177777, 0177777 }, { 0177760, 0000000, 0000000 }, { 0000000, 0000000, 0000000 }, 1 },
+	{ "DNZ", "0.5, truncated",			{ 0040000, 0100000, 0000000 }, { 0177760, 0000000, 0000000 }, { 0000000, 0000000, 0000000 }, 0 },
+	{ "DNZ", "-1.75, truncated",			{ 0140001, 0160000, 0000000 }, { 0177760, 0000000, 0000000 }, { 0000000, 0177777, 0000000 }, 0 },
+};
+#define NEDGE	(sizeof(edge)/sizeof(edge[0]))
+
+static void print_float(const ushort *p) {
+	printf("%06o %06o %06o",p[0],p[1],p[2]);
+}
+
+/* Run op on copies of a and b, the routines must not depend on the operands staying put */
+static int run_op(FloatOp op, const ushort *a, const ushort *b, ushort *r) {
+	ushort va[3], vb[3];
+	memcpy(va,a,sizeof(va));
+	memcpy(vb,b,sizeof(vb));
+	return op(va,vb,r);
+}
+
+/* Compare op(a,b) with want and rc, and list the first MAXREPORT mismatches */
+static bool check(const char *check, const char *name, FloatOp op, const ushort *a, const ushort *b,
+		const ushort *want, int rc, int *listed) {
+	ushort r[3];
+	int got = run_op(op,a,b,r);
+	if (!memcmp(r,want,sizeof(r)) && (got == rc))
+		return true;
+	if ((*listed)++ < MAXREPORT) {
+		printf("FAIL %s %s ",check,name);
+		print_float(a);
+		printf(", ");
+		print_float(b);
+		printf(": got ");
+		print_float(r);
+		printf(" (%d), expected ",got);
+		print_float(want);
+		printf(" (%d)\n",rc);
+	}
+	return false;
+}
+
+/* The golden vectors, mismatches per routine go into bad[], -1 if the file is unusable */
+static int check_vectors(int *count, int *bad) {
+	char line[256], name[8];
+	unsigned int v[9];
+	ushort a[3], b[3], want[3];
+	const struct FloatRoutine *fr;
+	int rc, i, n = 0, listed[FLOAT_ROUTINES] = { 0 };
+	FILE *f = fopen(VECFILE,"r");
+	if (!f) {
+		printf("FAIL: cannot open %s\n",VECFILE);
+		return -1;
+	}
+	while (fgets(line,sizeof(line),f)) {
+		if ((line[0] == '#') || (line[0] == '\n'))
+			continue;
+		if ((sscanf(line,"%7s %o %o %o %o %o %o %o %o %o %d",name,&v[0],&v[1],&v[2],&v[3],&v[4],&v[5],
+				&v[6],&v[7],&v[8],&rc) != 11) || !(fr = float_routine(name))) {
+			printf("FAIL: bad line in %s: %s",VECFILE,line);
+			fclose(f);
+			return -1;
+		}
+		for (i=0;i<3;i++) {
+			a[i] = v[i];
+			b[i] = v[i+3];
+			want[i] = v[i+6];
+		}
+		i = fr - float_routines;
+		count[i]++;
+		if (!check("vector",name,fr->op,a,b,want,rc,&listed[i]))
+			bad[i]++;
+		n++;
+	}
+	fclose(f);
+	return n;
+}
+
+/* The long double reference routines are slow, so they are timed on the first NGEN/100 operands */
+static double ops_per_sec(FloatOp op, ushort (*a)[3], ushort (*b)[3], int n) {
+	struct timespec t0, t1;
+	ushort r[3];
+	int i;
+	clock_gettime(CLOCK_MONOTONIC,&t0);
+	for (i=0;i<n;i++)
+		run_op(op,a[i],b[i],r);
+	clock_gettime(CLOCK_MONOTONIC,&t1);
+	return (double)n / ((t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9);
+}
+
+int main(int argc, char *argv[]) {
+	static ushort a[NGEN][3], b[NGEN][3];
+	int count[FLOAT_ROUTINES] = { 0 }, bad[FLOAT_ROUTINES] = { 0 };
+	ushort want[3], ro[3];
+	const struct FloatRoutine *fr;
+	int r, i, rc, listed, gen_bad, old_differ, edge_bad = 0, failed = 0;
+	unsigned int k;
+
+	setup_cpu();
+
+	for (k=0;k<NEDGE;k++) {
+		listed = 0;
+		fr = float_routine(edge[k].op);
+		if (!check("edge case",edge[k].what,fr->op,edge[k].a,edge[k].b,edge[k].want,edge[k].rc,&listed))
+			edge_bad++;
+	}
+	printf("%d of %d edge cases right\n",(int)NEDGE - edge_bad,(int)NEDGE);
+	failed += edge_bad;
+
+	if (check_vectors(count,bad) < 0)
+		failed++;
+
+	printf("\nroutine  vectors  wrong  generated  wrong   new ops/s   ref ops/s   old ops/s  old differs\n");
+	for (r=0;r<FLOAT_ROUTINES;r++) {
+		fr = &float_routines[r];
+		gen_bad = old_differ = listed = 0;
+		for (i=0;i<NGEN;i++) {
+			float_gen_operands(fr->name,a[i],b[i]);
+			rc = run_op(fr->ref,a[i],b[i],want);
+			if (!check("generated",fr->name,fr->op,a[i],b[i],want,rc,&listed))
+				gen_bad++;
+			if (fr->old && (run_op(fr->old,a[i],b[i],ro),memcmp(ro,want,sizeof(ro))))
+				old_differ++;
+		}
+		printf("%-7s %8d %6d %10d %6d %11.0f %11.0f ",fr->name,count[r],bad[r],NGEN,gen_bad,
+			ops_per_sec(fr->op,a,b,NGEN),ops_per_sec(fr->ref,a,b,NGEN/100));
+		if (fr->old)
+			printf("%11.0f %12d\n",ops_per_sec(fr->old,a,b,NGEN),old_differ);
+		else
+			printf("%11s %12s\n","-","-");
+		failed += bad[r] + gen_bad;
+	}
+	if (failed) {
+		printf("FAIL: %d mismatches\n",failed);
+		return 1;
+	}
+	printf("All float checks passed\n");
+	return 0;
+}
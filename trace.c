@@ -323,6 +323,91 @@ void disasm_dump(){
 	fclose(disasm_file);
 }
 
+void pairstat_init(){
+	pairstat_cnt = calloc(MAXPAIROPS,sizeof(*pairstat_cnt));
+	if (pairstat_cnt == NULL) {
+		PAIRSTATS = 0;
+		return;
+	}
+	pairstat_num=0;
+	pairstat_prev=0;
+}
+
+/*
+ * Count one executed instruction against the one executed before it.
+ */
+void pairstat_add(ushort instr){
+	ushort op = extract_opcode(instr);
+	int i = pairstat_idx[op];
+	if (!i) {
+		if (pairstat_num >= MAXPAIROPS-1) { /* Table full, just restart the pair */
+			pairstat_prev = 0;
+			return;
+		}
+		i = ++pairstat_num;
+		pairstat_idx[op] = i;
+		pairstat_word[i] = instr;
+	}
+	if (pairstat_prev)
+		pairstat_cnt[pairstat_prev][i]++;
+	pairstat_prev = i;
+}
+
+int pairstat_cmp(const void *a, const void *b){
+	unsigned long ca = ((struct pairstat_entry *)a)->cnt;
+	unsigned long cb = ((struct pairstat_entry *)b)->cnt;
+	return (ca < cb) ? 1 : (ca > cb) ? -1 : 0;
+}
+
+/*
+ * Dump all pairs seen, most frequent first.
+ * Format per line: count, percent of all pairs, first and second opcode class
+ * in octal and their mnemonics.
+ */
+void pairstat_dump(){
+	int i,j,n;
+	unsigned long total;
+	struct pairstat_entry *arr;
+	char str1[32], str2[32];
+
+	if (pairstat_cnt == NULL) return;
+	arr = calloc(pairstat_num*pairstat_num+1,sizeof(struct pairstat_entry));
+	if (arr == NULL) return;
+	n=0;
+	total=0;
+	for(i=1;i<=pairstat_num;i++){
+		for(j=1;j<=pairstat_num;j++){
+			if (pairstat_cnt[i][j]) {
+				arr[n].cnt = pairstat_cnt[i][j];
+				arr[n].first = i;
+				arr[n].second = j;
+				total += arr[n].cnt;
+				n++;
+			}
+		}
+	}
+	qsort(arr,n,sizeof(struct pairstat_entry),pairstat_cmp);
+
+	pairstat_file=fopen(pairstat_fname,pairstat_ftype);
+	if (pairstat_file == NULL) {
+		free(arr);
+		return;
+	}
+	fprintf(pairstat_file,"# %lu instruction pairs, %d different\n",total,n);
+	for(i=0;i<n;i++){
+		OpToStr(str1,pairstat_word[arr[i].first]);
+		OpToStr(str2,pairstat_word[arr[i].second]);
+		str1[strcspn(str1," ")] = '\0'; /* only the mnemonic */
+		str2[strcspn(str2," ")] = '\0';
+		fprintf(pairstat_file,"%12lu %6.2f%%  %06o %06o  %-8s %-8s\n",arr[i].cnt,
+			100.0*(double)arr[i].cnt/(double)total,
+			extract_opcode(pairstat_word[arr[i].first]),
+			extract_opcode(pairstat_word[arr[i].second]),str1,str2);
+	}
+	fclose(pairstat_file);
+	free(arr);
+}
+
 //void main (int argc, char *argv[]){
 //	instr_counter = 1000; // TEMP, REMOVE
 //	if (trace) trace_open;
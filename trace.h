@@ -20,17 +20,17 @@
  * distribution in the file COPYING); if not, see <http://www.gnu.org/licenses/>.
  */
 
-char tracename[]="tracefile.log";
+char *tracename="tracefile.log";
 char tracetype[]="a";
 FILE *tracefile;
 int trace;
 
 
-char trace2name[]="trace2file.log";
+char *trace2name="trace2file.log";
 char trace2type[]="a";
 FILE *trace2file;
 
-char disasm_fname[]="nd100em.disasm.log";
+char *disasm_fname="nd100em.disasm.log";
 char disasm_ftype[]="a";
 FILE *disasm_file;
 
@@ -52,6 +52,29 @@ struct disasm_entry {
 struct disasm_entry *disasm_arr[65536];
 struct disasm_entry *(*p_DIS)[] = &disasm_arr;
 
+/*
+ * Instruction pair statistics, to find which pairs of instructions
+ * are common enough in real code to be worth special handling.
+ * Instructions are counted per opcode class as given by extract_opcode.
+ */
+char *pairstat_fname="nd100em.pairs.log";
+char pairstat_ftype[]="a";
+FILE *pairstat_file;
+
+int PAIRSTATS;
+
+#define MAXPAIROPS 512
+ushort pairstat_idx[65536];		/* opcode class to index, 0 = not seen yet */
+ushort pairstat_word[MAXPAIROPS];	/* first instruction seen of each class, for naming */
+int pairstat_num;
+int pairstat_prev;
+unsigned long (*pairstat_cnt)[MAXPAIROPS];
+
+struct pairstat_entry {
+	unsigned long cnt;
+	ushort first, second;
+};
+
 volatile int ts_counter = 0;
 volatile int ts_step = 0;
 #define MAXTSARR 32
@@ -61,6 +84,7 @@ char ts_block[MAXTSARR][MAXTSSTR];
 extern char *regn[];
 extern double instr_counter;
 extern struct CpuRegs *gReg;
+extern struct CpuHot gHot;
 
 extern void OpToStr(char *opstr, ushort operand);
 extern ushort extract_opcode(ushort instr);
@@ -74,4 +98,7 @@ void disasm_exr(ushort addr, ushort instr);
 void disasm_setlbl(ushort addr);
 void disasm_userel(ushort addr, ushort where);
 void disasm_set_isdata(ushort addr);
+void pairstat_init();
+void pairstat_add(ushort instr);
+void pairstat_dump();
 